@@ -1,4 +1,6 @@
 #include <utility>
+#include <algorithm>
+#include <cstdlib>
 
 #include <unistd.h>
 #include <getopt.h>
@@ -22,6 +24,7 @@ int main(int argc, char *const argv[]) {
     { "interface", required_argument, 0, 'i' },
     { "verbosity", optional_argument, 0, 'v' },
     { "connect", required_argument, 0, 'c' },
+    { "workers", required_argument, 0, 'w' },
     { 0, 0, 0, 0 }
   };
 
@@ -37,10 +40,11 @@ int main(int argc, char *const argv[]) {
   bool connect_remote = false;
 
   int verbosity = -1;
+  size_t workers = 1;
 
   while (1) {
     int option_index = 0;
-    int c = getopt_long(argc, argv, "p:i:c:", long_options, &option_index);
+    int c = getopt_long(argc, argv, "p:i:c:w:", long_options, &option_index);
 
     if (c == -1)
       break;
@@ -71,6 +75,9 @@ int main(int argc, char *const argv[]) {
       log_info() << "Connection to remote node at " << remote.first << ":"
                  << remote.second;
     } break;
+    case 'w':
+      workers = std::max(1, atoi(optarg));
+      break;
     case '?':
     default:
       log_err() << "Unkown option code " << (char)c;
@@ -81,7 +88,7 @@ int main(int argc, char *const argv[]) {
     host.first.push_back("10.0.0.1");
 
   Logger::set_severity(verbosity);
-  hydra::node node(host.first, host.second, 1000 * 1000 * 3);
+  hydra::node node(host.first, host.second, 1000 * 1000 * 3, 1024, workers);
 
   if(connect_remote)
     node.join(remote.first, remote.second);
@@ -98,6 +105,7 @@ int main(int argc, char *const argv[]) {
     std::cout << "Load factor: " << node.load() << std::endl;
     std::cout << "Table Size:  " << node.size() << std::endl;
     std::cout << "used entries: " << node.used() << std::endl;
+    std::cout << "Memory: " << node.memory() << std::endl;
 #ifdef PROFILER
     ProfilerFlush();
 #endif
@@ -3,26 +3,49 @@
 #include <memory>
 #include <algorithm>
 #include <chrono>
+#include <random>
+#include <fstream>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
 #include "rdma/RDMAServerSocket.h"
 #include "hydra/node.h"
+#include "hydra/log_store.h"
 #include "RDMAWrapper.hpp"
 #include "util/utils.h"
 
 #include "allocators/ZoneHeap.h"
 #include "allocators/ThreadSafeHeap.h"
 #include "allocators/FreeListHeap.h"
+#include "allocators/LockFreeFreeListHeap.h"
 #include "allocators/SegregatedFitsHeap.h"
+#include "allocators/StaticSegregatedFitsHeap.h"
 #include "allocators/LockedHeap.h"
 #include "allocators/PerThreadAllocator.h"
+#include "allocators/ThreadCacheHeap.h"
 #include "RDMAAllocator.h"
+#include "allocators/allocators.h"
 
 using namespace hydra;
 using Heap_t = PerThreadHeap<LockedHeap<SegregatedFitsHeap<
     FreeListHeap<ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >,
     ZoneHeap<RdmaHeap<ibv_access::READ>, 256> > > >;
+using Segregated_t = SegregatedFitsHeap<
+    FreeListHeap<ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >,
+    ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >;
+using StaticSegregated_t = StaticSegregatedFitsHeap<
+    default_size_class,
+    FreeListHeap<ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >,
+    ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >;
+using Cached_t = ThreadCacheHeap<
+    default_size_class, ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> >;
+using Log_t = log_store<RdmaHeap<ibv_access::READ>, 64 * 1024 * 1024>;
 
-void time_allocation(Heap_t& heap, size_t count = 1024 * 1024, size_t size = 16) {
+template <typename Heap>
+void time_allocation(Heap &heap, size_t count = 1024 * 1024, size_t size = 16) {
   std::hash<std::thread::id> hash;
   log_info() << "Starting thread " << std::hex << std::showbase
              << std::this_thread::get_id() << " " << std::showbase
@@ -31,9 +54,9 @@ void time_allocation(Heap_t& heap, size_t count = 1024 * 1024, size_t size = 16)
   /* pre - allocate */
   auto start = std::chrono::high_resolution_clock::now();
   {
-    std::vector<decltype(heap.malloc<char>(size))> ptrs(count);
+    std::vector<decltype(heap.template malloc<char>(size))> ptrs(count);
     for (size_t i = 0; i < count; i++) {
-      ptrs.push_back(heap.malloc<char>(size));
+      ptrs.push_back(heap.template malloc<char>(size));
     }
   }
   auto end = std::chrono::high_resolution_clock::now();
@@ -43,19 +66,19 @@ void time_allocation(Heap_t& heap, size_t count = 1024 * 1024, size_t size = 16)
              << " ns";
 
   start = std::chrono::high_resolution_clock::now();
-  std::vector<decltype(heap.malloc<char>(size))> ptrs(count);
+  std::vector<decltype(heap.template malloc<char>(size))> ptrs(count);
   for (size_t i = 0; i < count; i++) {
-    ptrs.push_back(heap.malloc<char>(size));
+    ptrs.push_back(heap.template malloc<char>(size));
   }
   end = std::chrono::high_resolution_clock::now();
   auto hot_stor = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
 
   log_info() << "Hot allocation + storage: " << hot_stor.count() / count << " ns";
 
-  std::vector<decltype(heap.malloc<char>(size))> ptrs_(count);
+  std::vector<decltype(heap.template malloc<char>(size))> ptrs_(count);
   start = std::chrono::high_resolution_clock::now();
   for (size_t i = 0; i < count; i++) {
-    ptrs_.push_back(decltype(heap.malloc<char>(size))());
+    ptrs_.push_back(decltype(heap.template malloc<char>(size))());
   }
   end = std::chrono::high_resolution_clock::now();
   auto stor = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
@@ -69,7 +92,8 @@ void time_allocation(Heap_t& heap, size_t count = 1024 * 1024, size_t size = 16)
   }
 } 
 
-void multi_thread_alloc(Heap_t &heap, size_t num_threads = 4,
+template <typename Heap>
+void multi_thread_alloc(Heap &heap, size_t num_threads = 4,
                         size_t count = 1024 * 1024, size_t size = 16) {
   log_info() << "Running multithreaded allocation test with " << num_threads  << " threads.";
 #if 0
@@ -87,6 +111,253 @@ void multi_thread_alloc(Heap_t &heap, size_t num_threads = 4,
 #endif
 }
 
+/* Contention on a single size class: every thread repeatedly takes batch
+ * blocks and gives them back. The free list is filled up front, so that only
+ * the free list itself is measured and SuperHeap is never called.
+ */
+template <template <typename> class FreeList>
+void free_list_scaling(RDMAServerSocket &socket, size_t batch = 64,
+                       size_t rounds = 16 * 1024, size_t size = 64) {
+  for (size_t num_threads = 1; num_threads <= 32; num_threads *= 2) {
+    FreeList<ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024> > heap(socket);
+    {
+      std::vector<decltype(heap.template malloc<char>(size))> ptrs;
+      for (size_t i = 0; i < num_threads * batch; i++)
+        ptrs.push_back(heap.template malloc<char>(size));
+    }
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < num_threads; i++)
+      threads.emplace_back([&]() {
+        std::vector<decltype(heap.template malloc<char>(size))> ptrs(batch);
+        for (size_t round = 0; round < rounds; round++) {
+          for (auto &&ptr : ptrs)
+            ptr = heap.template malloc<char>(size);
+          for (auto &&ptr : ptrs)
+            ptr.first.reset();
+        }
+      });
+    for (auto &thread : threads)
+      thread.join();
+    auto end = std::chrono::high_resolution_clock::now();
+    auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    log_info() << num_threads << " threads: "
+               << dur.count() / (rounds * batch)
+               << " ns per malloc/free pair";
+  }
+}
+
+/* Single-threaded allocation of mixed sizes out of a live set, as the client
+ * allocates buffers for lookups. Sizes are drawn up front.
+ */
+template <typename Heap>
+void segregated_fits(Heap &heap, size_t live = 4096, size_t ops = 1024 * 1024) {
+  std::mt19937_64 gen;
+  std::uniform_int_distribution<size_t> slot(0, live - 1);
+  std::uniform_int_distribution<size_t> size(1, 8192);
+  std::vector<std::pair<size_t, size_t> > requests(ops);
+  for (auto &&request : requests)
+    request = std::make_pair(slot(gen), size(gen));
+
+  std::vector<decltype(heap.template malloc<char>(1))> ptrs(live);
+  for (size_t round = 0; round < 2; round++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto &request : requests)
+      ptrs[request.first] = heap.template malloc<char>(request.second);
+    auto end = std::chrono::high_resolution_clock::now();
+    auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    log_info() << (round ? "Hot" : "Cold") << " allocation: "
+               << dur.count() / ops << " ns";
+  }
+  heap_stats stats;
+  heap.stats(stats);
+  log_info() << stats;
+}
+
+/* Latency of the registered-memory layer itself and the number of memory
+ * regions it leaves the NIC with. Compare RDMA_ARENA 0 and 1.
+ */
+void time_registration(RDMAServerSocket &socket, size_t count = 256,
+                       size_t size = 1024 * 1024) {
+  RdmaHeap<ibv_access::READ> heap(socket);
+  auto &stats = hydra::rdma_heap_stats::instance();
+  const size_t registrations = stats.registrations;
+
+  std::vector<decltype(heap.malloc<char>(size))> ptrs;
+  ptrs.reserve(count);
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < count; i++)
+    ptrs.push_back(heap.malloc<char>(size));
+  auto end = std::chrono::high_resolution_clock::now();
+  auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+
+  log_info() << "Registered allocation of " << size << " bytes: "
+             << dur.count() / count << " ns, "
+             << stats.registrations - registrations << " memory regions for "
+             << count << " allocations";
+}
+
+/* dTLB load misses of the calling thread while f runs, -1 if not available */
+template <typename F> long long tlb_misses(F &&f) {
+  perf_event_attr attr = {};
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  const int fd =
+      static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  if (fd < 0) {
+    f();
+    return -1;
+  }
+  ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+  ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  f();
+  ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+  long long count = -1;
+  if (read(fd, &count, sizeof(count)) != sizeof(count))
+    count = -1;
+  close(fd);
+  return count;
+}
+
+/* Latency of the first put into a fresh pool, which has to map and register
+ * a region unless it was reserved up front, and TLB misses of random reads
+ * over the pool afterwards.
+ */
+void pool_backing(RDMAServerSocket &socket, const rdma_pool_config &config,
+                  size_t size = 1024 * 1024 * 1024, size_t reads = 1 << 24) {
+  hydra::rdma_arena arena([&socket](void *ptr, size_t size) {
+                            return register_memory(socket, ibv_access::READ,
+                                                   ptr, size);
+                          },
+                          size);
+  arena.configure(config);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  arena.reserve(config.reserve);
+  auto end = std::chrono::high_resolution_clock::now();
+  auto setup =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+  start = std::chrono::high_resolution_clock::now();
+  auto span = arena.allocate(size);
+  memset(span.first, 0, 64);
+  end = std::chrono::high_resolution_clock::now();
+  auto first =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  memset(span.first, 0, size);
+
+  std::mt19937_64 gen;
+  std::uniform_int_distribution<size_t> offset(0, size / 64 - 1);
+  std::vector<size_t> offsets(reads);
+  for (auto &&o : offsets)
+    o = offset(gen) * 64;
+  volatile char sum = 0;
+  const long long misses = tlb_misses([&]() {
+    for (const auto &o : offsets)
+      sum += span.first[o];
+  });
+
+  log_info() << "NUMA node " << config.numa_node << ", huge pages "
+             << config.huge_pages << ", prefault " << config.prefault
+             << ", reserve " << (config.reserve >> 20) << " MiB: setup "
+             << setup.count() << " us, first put " << first.count()
+             << " us, " << misses << " dTLB misses for " << reads << " reads";
+  arena.deallocate(span.first, size);
+}
+
+static size_t resident_set() {
+  size_t pages = 0, resident = 0;
+  std::ifstream statm("/proc/self/statm");
+  statm >> pages >> resident;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/* 50/50 put/delete churn on the node's value heap. The resident set should
+ * level off once the live set has reached steady state.
+ */
+void churn(RDMAServerSocket &socket, size_t live_keys = 64 * 1024,
+           size_t rounds = 20, size_t ops = 1024 * 1024) {
+  default_heap_t heap(socket);
+  std::mt19937_64 gen;
+  std::uniform_int_distribution<size_t> key(0, live_keys - 1);
+  std::uniform_int_distribution<size_t> value_size(73, 4096);
+  std::vector<decltype(heap.malloc<unsigned char>(1))> values(live_keys);
+
+  for (size_t round = 0; round < rounds; round++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t op = 0; op < ops; op++) {
+      auto &value = values[key(gen)];
+      if (gen() & 1) {
+        const size_t size = value_size(gen);
+        value = heap.malloc<unsigned char>(size);
+        memset(value.first.get(), 0, size);
+      } else {
+        value.first.reset();
+      }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    auto dur = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    heap_stats stats;
+    heap.stats(stats);
+    log_info() << "Churn round " << round << ": " << dur.count() / ops
+               << " ns/op, RSS " << (resident_set() >> 20) << " MiB, "
+               << (stats.requested >> 20) << " MiB requested in "
+               << (stats.allocated >> 20) << " MiB, "
+               << (stats.free_bytes >> 20) << " MiB free";
+  }
+}
+
+/* Footprint over hours of put/delete churn whose value sizes drift, as the
+ * workload of a long-running node changes. An hour is ops operations; clean
+ * gets to compact every few thousand of them. Values start with their key.
+ */
+template <typename Allocate, typename Clean, typename Stats>
+void fragmentation(const char *name, Allocate &&allocate, Clean &&clean,
+                   Stats &&stats, size_t hours = 24,
+                   size_t live_keys = 64 * 1024, size_t ops = 1024 * 1024) {
+  std::mt19937_64 gen;
+  std::uniform_int_distribution<uint64_t> key(0, live_keys - 1);
+  std::vector<decltype(allocate(size_t(1)))> values(live_keys);
+  std::vector<size_t> sizes(live_keys, 0);
+  size_t live = 0;
+
+  for (size_t hour = 0; hour < hours; hour++) {
+    /* between 64 bytes and 8 KiB, moving every hour */
+    const size_t base = size_t(64) << ((hour * 3) % 7);
+    std::uniform_int_distribution<size_t> value_size(base, 2 * base);
+    for (size_t op = 0; op < ops; op++) {
+      const uint64_t k = key(gen);
+      live -= sizes[k];
+      sizes[k] = 0;
+      if (gen() & 1) {
+        const size_t size = value_size(gen);
+        auto value = allocate(size);
+        memcpy(value.first.get(), &k, sizeof(k));
+        values[k] = std::move(value);
+        sizes[k] = size;
+        live += size;
+      } else {
+        values[k].first.reset();
+      }
+      if (op % 4096 == 0)
+        clean(values);
+    }
+    heap_stats s;
+    stats(s);
+    const size_t footprint = s.allocated + s.wasted();
+    log_info() << name << " hour " << hour << ": " << (live >> 20)
+               << " MiB live, footprint " << (footprint >> 20) << " MiB ("
+               << double(footprint) / live << "x)";
+  }
+}
+
 int main(int argc, char *const argv[]) {
   std::cout << "Size of std::atomic_flag: " << sizeof(std::atomic_flag)
             << std::endl;
@@ -103,6 +374,7 @@ int main(int argc, char *const argv[]) {
     return class_;
   };
   Heap_t heap(4U, 1U, size2Class, socket);
+  Cached_t cached_heap(socket);
 
   log_info() << "Measurement resolution: "
              << std::chrono::duration_cast<std::chrono::nanoseconds>(
@@ -110,5 +382,65 @@ int main(int argc, char *const argv[]) {
              << " ns";
 
   //time_allocation(heap);
+  log_info() << "PerThreadHeap:";
   multi_thread_alloc(heap, 4, 1024*512);
+  log_info() << "ThreadCacheHeap:";
+  multi_thread_alloc(cached_heap, 4, 1024*512);
+
+  log_info() << "FreeListHeap:";
+  free_list_scaling<FreeListHeap>(socket);
+  log_info() << "LockFreeFreeListHeap:";
+  free_list_scaling<LockFreeFreeListHeap>(socket);
+
+  {
+    log_info() << "SegregatedFitsHeap:";
+    Segregated_t segregated(48U, default_size_classes, socket);
+    segregated_fits(segregated);
+    log_info() << "StaticSegregatedFitsHeap:";
+    StaticSegregated_t static_segregated(socket);
+    segregated_fits(static_segregated);
+  }
+
+  {
+    rdma_pool_config plain;
+    plain.huge_pages = false;
+    plain.prefault = false;
+    pool_backing(socket, plain);
+    rdma_pool_config pool = hydra::node::node_pool_config();
+    pool.numa_node = socket.numa_node();
+    pool.reserve = 1024 * 1024 * 1024;
+    pool_backing(socket, pool);
+  }
+
+  time_registration(socket);
+  churn(socket);
+
+  {
+    default_heap_t heap(socket);
+    fragmentation("BuddyHeap",
+                  [&](size_t size) { return heap.malloc<unsigned char>(size); },
+                  [](auto &) {}, [&](heap_stats &s) { heap.stats(s); });
+  }
+  {
+    Log_t log(socket);
+    fragmentation(
+        "log_store",
+        [&](size_t size) { return log.append(size, sizeof(uint64_t)); },
+        [&](auto &values) {
+          log.clean([&](const unsigned char *from, size_t,
+                        Log_t::rdma_ptr<unsigned char> &copy) {
+            uint64_t k;
+            memcpy(&k, from, sizeof(k));
+            if (values[k].first.get() != from)
+              return false;
+            values[k] = std::move(copy);
+            return true;
+          });
+        },
+        [&](heap_stats &s) { log.stats(s); });
+  }
+  auto &stats = hydra::rdma_heap_stats::instance();
+  log_info() << "Memory regions: " << stats.registrations << " ("
+             << (stats.registered_bytes >> 20) << " MiB) for "
+             << stats.allocations << " allocations";
 }
@@ -0,0 +1,65 @@
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "hydra/client.h"
+
+/* Aggregate throughput of client::multi_get for growing batch sizes. */
+int main(int argc, const char *argv[]) {
+  using key_t = std::vector<unsigned char>;
+  const size_t max_keys = (argc < 2) ? 1000 * 10 : atoi(argv[1]);
+  const size_t value_length = 64;
+  const auto measurement_time = std::chrono::seconds(10);
+
+  hydra::client client("10.10", "8042");
+
+  std::mt19937_64 generator;
+  std::uniform_int_distribution<unsigned char> bytes(' ', '~');
+  std::vector<key_t> keys;
+  keys.reserve(max_keys);
+  for (size_t i = 0; i < max_keys; i++) {
+    std::ostringstream ss;
+    ss << std::setw(4) << i;
+    const auto str = ss.str();
+    keys.emplace_back(std::begin(str), std::end(str));
+  }
+
+  for (size_t begin = 0; begin < keys.size(); begin += 256) {
+    std::vector<std::pair<key_t, key_t> > kvs;
+    for (size_t i = begin; i < std::min(keys.size(), begin + 256); i++) {
+      key_t value;
+      std::generate_n(std::back_inserter(value), value_length,
+                      [&]() { return bytes(generator); });
+      kvs.emplace_back(keys[i], std::move(value));
+    }
+    client.multi_put(kvs);
+  }
+
+  std::uniform_int_distribution<size_t> distribution(0, max_keys - 1);
+  for (const size_t batch_size : { 16, 32, 64, 128, 256 }) {
+    std::vector<key_t> batch(batch_size);
+    size_t ops = 0;
+    size_t found = 0;
+
+    using namespace std::chrono;
+    const auto start = high_resolution_clock::now();
+    while (high_resolution_clock::now() - start < measurement_time) {
+      for (auto &&key : batch)
+        key = keys[distribution(generator)];
+      for (const auto &value : client.multi_get(batch))
+        found += !value.empty();
+      ops += batch_size;
+    }
+    const auto us =
+        duration_cast<microseconds>(high_resolution_clock::now() - start)
+            .count();
+
+    std::cout << "batch " << std::setw(3) << batch_size << ": "
+              << ops * 1000 / us << " kOps/s (" << found << "/" << ops
+              << " found)" << std::endl;
+  }
+}
@@ -2,144 +2,76 @@
 #include <sstream>
 #include <atomic>
 #include <thread>
+#include <deque>
 #include <iostream>
 
-#include "rdma/RDMAClientSocket.h"
-#include "protocol/message.h"
-
-#include "hydra/allocators/ZoneHeap.h"
-#include "hydra/RDMAAllocator.h"
-
-using response_t = kj::FixedArray<capnp::word, 9>;
-struct data {
-  rdma_ptr<response_t> response;
-  rdma_ptr<unsigned char> kv;
-  size_t i = 0;
-  size_t length;
-  size_t key_length;
-  data(rdma_ptr<response_t> response, rdma_ptr<unsigned char> kv,
-       const size_t length, const size_t key_length)
-      : response(std::move(response)), kv(std::move(kv)), length(length),
-        key_length(key_length) {}
-};
-
-using iterator = std::vector<data>::iterator;
-
-#if 0
-static hydra::future<future<void> > send(RDMAClientSocket &socket,
-                                         iterator current, const iterator end) {
-  promise<void> promise;
-  auto result = promise.get_future();
-  socket.recv_async(current->response.first, current->response.second)
-      .then([current, end, promise = std::move(promise)](auto &&result) {
-         result.value();
-         auto &&request = *current;
-         std::cout << "Received " << static_cast<void *>(&request) << " "
-                   << request.i << std::endl;
-         auto reply = capnp::FlatArrayMessageReader(*request.response.first);
-         auto reader = reply.getRoot<hydra::protocol::DHTResponse>();
-
-         assert(reader.getAck().getSuccess());
-
-         if (current != end) {
-            send(socket, ++current, end);
-         }
-       });
-
-  socket.send(put_message(request.kv, request.length, request.key_length));
-
-  return result;
-}
-#endif
-static hydra::future<void> send(RDMAClientSocket &socket, data &request) {
-  auto result =
-      socket.recv_async(*request.response.first, request.response.second)
-          .then([&request](auto &&result) {
-             result.value();
-             auto reply =
-                 capnp::FlatArrayMessageReader(*request.response.first);
-             auto reader = reply.getRoot<hydra::protocol::DHTResponse>();
-
-             assert(reader.getAck().getSuccess());
-           });
-
-  socket.send(put_message(request.kv, request.length, request.key_length));
-  return result;
-}
+#include "hydra/passive.h"
 
+/* With registered, the key/values are laid out in one registered buffer and
+ * sent by put_registered(), instead of being copied by put_async().
+ */
 static void load_keys(const std::string &host, const std::string &port,
-                      const size_t max_keys, const size_t value_length) {
-  RDMAClientSocket socket(host, port);
-  socket.connect();
-  hydra::ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024 * 16> heap(socket);
+                      const size_t max_keys, const size_t value_length,
+                      const bool registered) {
+  const size_t depth = 32;
+  hydra::passive socket(host, port, depth);
 
   std::mt19937_64 generator;
   std::uniform_int_distribution<unsigned char> distribution(' ', '~');
 
-  std::vector<data> requests;
+  std::vector<std::pair<std::vector<unsigned char>, size_t> > requests;
   requests.reserve(max_keys);
 
   for (size_t i = 0; i < max_keys; i++) {
     std::ostringstream ss;
     ss << std::setw(4) << i;
 
-    const size_t key_length = ss.str().size();
-
-    const size_t length = key_length + value_length;
-    requests.emplace_back(heap.malloc<response_t>(1),
-                          heap.malloc<unsigned char>(length), length,
-                          key_length);
-
-    data &data = requests.back();
-    memcpy(data.kv.first.get(), ss.str().c_str(), key_length);
-    unsigned char *value = data.kv.first.get() + key_length;
-    for (size_t byte = 0; byte < value_length; byte++) {
-      value[byte] = distribution(generator);
-    }
-    data.i = i;
+    const auto key = ss.str();
+    std::vector<unsigned char> kv(std::begin(key), std::end(key));
+    std::generate_n(std::back_inserter(kv), value_length,
+                    [&]() { return distribution(generator); });
+    requests.emplace_back(std::move(kv), key.size());
   }
 
   std::cout << requests.size() << std::endl;
 
-  hydra::promise<void> p;
-  hydra::future<void> future = p.get_future();
-
-  for (auto &&request : requests) {
-    hydra::future<hydra::future<void> > f =
-        future.then([&socket, &request](auto &&result) {
-          result.value();
-          return send(socket, request);
-        });
-
-    f.unwrap();
-
-    /* proxy */
-    hydra::promise<void> promise;
-    future = promise.get_future();
-    /* unwrap */
-    f.then([promise = std::move(promise)](auto && inner_future) mutable {
-      try {
-        inner_future.value()
-            .then([promise = std::move(promise)](auto && value) mutable {
-               try {
-                 value.value();
-                 promise.set_value();
-               }
-               catch (...) {
-                 promise.set_exception(std::current_exception());
-               }
-             });
-      }
-      catch (...) {
-        promise.set_exception(std::current_exception());
-      }
-    });
+  /* offset of each request in buffer */
+  std::vector<unsigned char> buffer;
+  std::vector<size_t> offsets;
+  hydra::passive::registered_buffer registered_buffer{};
+  if (registered) {
+    offsets.reserve(requests.size());
+    for (auto &&request : requests) {
+      offsets.push_back(buffer.size());
+      buffer.insert(buffer.end(), request.first.begin(), request.first.end());
+    }
+    registered_buffer = socket.register_buffer(buffer.data(), buffer.size());
   }
 
+  /* keep depth puts in flight */
+  std::deque<hydra::future<bool> > pending;
+  auto wait = [](hydra::future<bool> &future) {
+    const bool success = future.get().value();
+    assert(success);
+    (void)success;
+  };
   auto start = std::chrono::high_resolution_clock::now();
 
-  p.set_value();
-  future.get();
+  for (size_t i = 0; i < requests.size(); i++) {
+    if (pending.size() == depth) {
+      wait(pending.front());
+      pending.pop_front();
+    }
+    const auto &request = requests[i];
+    if (registered)
+      pending.push_back(socket.put_registered(registered_buffer, offsets[i],
+                                              request.first.size(),
+                                              request.second));
+    else
+      pending.push_back(socket.put_async(request.first, request.second));
+  }
+  for (auto &&future : pending)
+    wait(future);
 
   auto end = std::chrono::high_resolution_clock::now();
 
@@ -171,6 +103,7 @@ static void load_keys(const std::string &host, const std::string &port,
 
 int main(int argc, char const *const argv[]) {
   const size_t value_length = (argc < 2) ? 64 : atoi(argv[1]);
+  const bool registered = argc > 2 && std::string(argv[2]) == "registered";
   const size_t max_keys = 1000 * 10;
   const size_t min_threads = 1;
   const size_t max_threads = 1;
@@ -190,7 +123,8 @@ int main(int argc, char const *const argv[]) {
       threads.reserve(cur_threads);
 
       std::generate_n(std::back_inserter(threads), cur_threads, [=]() {
-        return std::thread(load_keys, "10.10", "8042", max_keys, value_length);
+        return std::thread(load_keys, "10.10", "8042", max_keys, value_length,
+                           registered);
       });
 
       for (auto &&thread : threads) {
@@ -3,6 +3,11 @@
 #include <vector>
 #include <cstdint>
 #include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <limits>
 
 #include "hydra/hash.h"
 
@@ -89,6 +94,125 @@ void distribution(const size_t bins, const size_t n_threads) {
   }
 }
 
+/* Keys as the load generator makes them: decimal numbers, right-aligned and
+ * padded with blanks to the key size, back to back in data.
+ */
+struct keys_t {
+  std::vector<unsigned char> data;
+  std::vector<const unsigned char *> keys;
+  std::vector<size_t> sizes;
+
+  keys_t(const size_t n, const size_t size) : data(n * size, ' ') {
+    for (size_t i = 0; i < n; i++) {
+      std::ostringstream ss;
+      ss << i;
+      const auto key = ss.str();
+      std::copy(key.begin(), key.end(), data.begin() + (i + 1) * size -
+                                            static_cast<long>(key.size()));
+    }
+    for (size_t i = 0; i < n; i++) {
+      keys.push_back(data.data() + i * size);
+      sizes.push_back(size);
+    }
+  }
+};
+
+/* ns/key one at a time and batched, over keys which fit into the cache, and
+ * how evenly all keys fall into as many slots as there are keys:
+ * chi^2/(slots - 1) is about 1 for a random placement, the fullest slot holds
+ * about 8 of a million keys.
+ */
+template <typename Hash>
+static void key_hash(const char *name, const keys_t &keys) {
+  const size_t n = keys.keys.size();
+  const size_t hot = std::min<size_t>(n, 1024);
+  const size_t rounds = 1000;
+  std::vector<uint64_t> hashes(n);
+  std::vector<uint64_t> batched(n);
+
+  /* the fastest round, others may have been interrupted */
+  using ns = std::chrono::duration<double, std::nano>;
+  double single = std::numeric_limits<double>::max();
+  double batch = std::numeric_limits<double>::max();
+  for (size_t r = 0; r < rounds; r++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < hot; i++)
+      hashes[i] = Hash::hash(keys.keys[i], keys.sizes[i]);
+    auto mid = std::chrono::high_resolution_clock::now();
+    Hash::hash(keys.keys.data(), keys.sizes.data(), hot, batched.data());
+    auto end = std::chrono::high_resolution_clock::now();
+    single = std::min(single, ns(mid - start).count());
+    batch = std::min(batch, ns(end - mid).count());
+  }
+
+  for (size_t i = 0; i < n; i++)
+    hashes[i] = Hash::hash(keys.keys[i], keys.sizes[i]);
+  Hash::hash(keys.keys.data(), keys.sizes.data(), n, batched.data());
+  if (hashes != batched)
+    std::cerr << name << ": batched hashes differ" << std::endl;
+
+  std::vector<uint32_t> slots(n, 0);
+  for (auto &&h : hashes)
+    slots[hydra::reduce(h, n)]++;
+  double chi2 = 0;
+  for (auto &&count : slots)
+    chi2 += (count - 1.0) * (count - 1.0);
+  const auto fullest = *std::max_element(slots.begin(), slots.end());
+
+  std::cout << std::setw(8) << name << std::setw(6) << keys.sizes.front()
+            << std::fixed << std::setprecision(2) << std::setw(8)
+            << single / hot << " ns/key" << std::setw(8) << batch / hot
+            << " ns/key batched"
+            << std::setw(8) << chi2 / static_cast<double>(n - 1)
+            << " chi2/df" << std::setw(4) << fullest << " max" << std::endl;
+}
+
+/* home slots of the hashes, by the 128 bit modulo used before and by
+ * hydra::reduce()
+ */
+static void home_slots(const size_t table_size) {
+  std::vector<uint64_t> hashes(1024);
+  for (size_t i = 0; i < hashes.size(); i++)
+    hashes[i] = hydra::wy_hash::hash(&i, sizeof(i));
+
+  using ns = std::chrono::duration<double, std::nano>;
+  double modulo = std::numeric_limits<double>::max();
+  double reduce = std::numeric_limits<double>::max();
+  volatile size_t sink = 0;
+  for (size_t r = 0; r < 1000; r++) {
+    size_t sum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (auto &&h : hashes)
+      sum += static_cast<size_t>(static_cast<__uint128_t>(h) % table_size);
+    auto mid = std::chrono::high_resolution_clock::now();
+    for (auto &&h : hashes)
+      sum += hydra::reduce(h, table_size);
+    auto end = std::chrono::high_resolution_clock::now();
+    sink = sink + sum;
+    modulo = std::min(modulo, ns(mid - start).count());
+    reduce = std::min(reduce, ns(end - mid).count());
+  }
+  std::cout << "home of " << table_size << " slots: " << std::fixed
+            << std::setprecision(2) << modulo / hashes.size()
+            << " ns modulo, " << reduce / hashes.size() << " ns reduce"
+            << std::endl;
+}
+
+static void key_hashes() {
+  home_slots(1000 * 1000 + 3);
+  for (const size_t size : { 4, 8, 16, 32, 64 }) {
+    /* as many keys as there are numbers of size digits, up to a million */
+    size_t n = 1;
+    for (size_t i = 0; i < size && n < 1000 * 1000; i++)
+      n *= 10;
+    const keys_t keys(n, size);
+    key_hash<hydra::city128_hash>("city128", keys);
+    key_hash<hydra::city64_hash>("city64", keys);
+    key_hash<hydra::wy_hash>("wyhash", keys);
+    key_hash<hydra::crc_hash>("crc32c", keys);
+  }
+}
+
 int main() {
 #if 0
   size_t iterations = 10 * 1000;
@@ -109,6 +233,7 @@ int main() {
 
   // std::cout << "Min: " << min << std::endl;
 #else
+  key_hashes();
   distribution(4, 32 * 1000);
 #endif
 }
@@ -1,17 +1,26 @@
 #include <vector>
 #include <tuple>
 #include <algorithm>
+#include <numeric>
+#include <random>
+#include <functional>
+#include <iomanip>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <future>
+#include <limits>
 
 #include "hydra/server_dht.h"
 #include "hydra/hopscotch-server.h"
+#include "hydra/hash.h"
 
 #define SPIN_LOCK 1
 
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
 using hash_table_t = hydra::hopscotch_server;
 #elif SPIN_LOCK
 #include "util/concurrent.h"
@@ -20,125 +29,392 @@ using hash_table_t = monitor<hydra::hopscotch_server, hydra::spinlock>;
 using hash_table_t = monitor<hydra::hopscotch_server>;
 #endif
 
-void add(hash_table_t &dht, const size_t &size, const size_t &elems) {
-  using namespace std::literals::chrono_literals;
-    
-  std::mt19937_64 generator;
+using request_t = std::tuple<
+    std::unique_ptr<unsigned char, std::function<void(unsigned char *)> >,
+    size_t, size_t, uint32_t>;
+
+static hydra::Return_t add(hash_table_t &dht, request_t &request) {
+#if STRIPED_LOCKS
+  return dht.add(request);
+#else
+  return dht([&request](auto &&dht) {
+    //dht.check_consistency();
+    auto ret = dht.add(request);
+    //dht.check_consistency();
+    return ret;
+  });
+#endif
+}
+
+static std::vector<request_t> generate_requests(const size_t &size,
+                                                const size_t &first,
+                                                const size_t &elems) {
+  std::mt19937_64 generator(first);
   std::uniform_int_distribution<unsigned char> distribution(' ', '~');
-  
-  size_t elem = 0;
-  auto generate_request = [&]() {
+
+  std::vector<request_t> requests;
+  requests.reserve(elems);
+
+  for (size_t elem = first; elem < first + elems; elem++) {
     std::unique_ptr<unsigned char, std::function<void(unsigned char *)> > ptr(
         reinterpret_cast<unsigned char *>(::malloc(size)), ::free);
 
     std::ostringstream ss;
     ss << std::setw(4) << elem;
 
-#if 0
-    elem = (elem + 1) % 255;
-#else
-    elem++;
-#endif
-
     const size_t key_size = ss.str().size();
     memcpy(ptr.get(), ss.str().c_str(), key_size);
-#if 1
-    std::generate_n(ptr.get() + key_size, size - key_size, std::bind(distribution, generator));
+    std::generate_n(ptr.get() + key_size, size - key_size,
+                    std::bind(distribution, generator));
+    const uint32_t rkey = 1;
+    requests.emplace_back(std::move(ptr), size, key_size, rkey);
+  }
+
+  return requests;
+}
+
+static void add(hash_table_t &dht, std::vector<request_t> &requests,
+                const std::atomic_bool &start, size_t &added) {
+  while (!start.load())
+    std::this_thread::yield();
+
+  for (added = 0; added < requests.size(); added++) {
+    if (add(dht, requests[added]) == hydra::NEED_RESIZE)
+      break;
+  }
+}
+
+using bytes_t = std::vector<unsigned char>;
+
+static std::vector<bytes_t> keys_of(const std::vector<request_t> &requests) {
+  std::vector<bytes_t> keys;
+  keys.reserve(requests.size());
+  for (auto &&request : requests) {
+    const unsigned char *kv = std::get<0>(request).get();
+    keys.emplace_back(kv, kv + std::get<2>(request));
+  }
+  return keys;
+}
+
+static size_t contains(hash_table_t &dht, const bytes_t &key) {
+  const hydra::server_dht::key_type k(key.data(), key.size());
+#if STRIPED_LOCKS
+  return dht.contains(k);
 #else
-    /* simulate transfer delay */
-    std::this_thread::sleep_for(10us);
+  return dht([&k](auto &&dht) { return dht.contains(k); });
 #endif
-    const uint32_t rkey = 1;
-    return std::make_tuple(std::move(ptr), size, key_size, rkey);
-  };
+}
 
-  auto gen_time = 0ns;
-  auto add_time = 0ns;
-  size_t added;
-  std::cout << "Running" << std::endl;
-  for (added = 0; added < elems; added++) {
-    auto start = std::chrono::high_resolution_clock::now();
-    auto request = generate_request();
+/* best of a few rounds, the machine may be busy otherwise */
+template <typename F>
+static double ns_per_key(const std::vector<bytes_t> &keys, F &&f) {
+  double best = std::numeric_limits<double>::max();
+  for (size_t round = 0; round < 5; round++) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (auto &&key : keys)
+      f(key);
     auto end = std::chrono::high_resolution_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::nano>(end - begin).count());
+  }
+  return best / keys.size();
+}
 
-    gen_time +=
-        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+using neighbourhood_t = const RDMAObj<hydra::hash_table_entry> *;
 
-    start = std::chrono::high_resolution_clock::now();
-    auto ret = dht([request = std::move(request)](auto && dht) mutable {
-      //dht.check_consistency();
-      auto ret = dht.add(request);
-      //dht.check_consistency();
-      return ret;
-    });
-    end = std::chrono::high_resolution_clock::now();
+/* How the client scanned a neighbourhood before fingerprints: every entry the
+ * hop word points to with the length of key has its key compared. Comparing
+ * a key not inlined costs the client an RDMA read.
+ */
+static size_t scan_hops(neighbourhood_t entries, const size_t n,
+                        const bytes_t &key, size_t &compared) {
+  const auto hop = entries[0].get().hop;
+  for (size_t d = 0; d < n; d++) {
+    const auto &entry = entries[d].get();
+    if (!(hop & (1U << d)) || entry.is_empty() ||
+        (key.size() != entry.key_length()))
+      continue;
+    compared++;
+    if (std::equal(std::begin(key), std::end(key), entry.key()))
+      return d;
+  }
+  return n;
+}
 
-    add_time +=
-        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+static size_t scan_fingerprints(neighbourhood_t entries, const size_t n,
+                                const bytes_t &key, size_t &compared) {
+  const uint32_t fingerprint =
+      hydra::fingerprint(hydra::hash(key.data(), key.size()));
+  for (uint32_t c = hydra::candidates(entries, 0, n, fingerprint, key.size());
+       c; c &= c - 1) {
+    const size_t d = static_cast<size_t>(__builtin_ctz(c));
+    compared++;
+    if (std::equal(std::begin(key), std::end(key), entries[d].get().key()))
+      return d;
+  }
+  return n;
+}
 
-    if (ret == hydra::NEED_RESIZE)
+/* Lookups on a table filled up to load_factor, of keys present and absent:
+ * contains() on the server, and the client's scan of a neighbourhood it has
+ * read. The client scans the table in place, so the copy of the neighbourhood
+ * is not part of its cost.
+ */
+static void lookups(const size_t hop_range, const size_t elems,
+                    const size_t table_size, const size_t size) {
+  using table_t = std::vector<LocalRDMAObj<hydra::hash_table_entry> >;
+  table_t table(table_size);
+  hash_table_t dht(table.data(), hop_range, table_size);
+
+  auto requests = generate_requests(size, 0, elems);
+  const auto hits = keys_of(requests);
+  /* absent keys of the same lengths */
+  const auto misses = [&hits]() {
+    auto keys = hits;
+    for (auto &&key : keys)
+      key[0] = '#';
+    return keys;
+  }();
+  size_t added = 0;
+  for (; added < requests.size(); added++) {
+    if (add(dht, requests[added]) == hydra::NEED_RESIZE)
       break;
   }
+  if (added != elems)
+    std::cout << "Aborted after " << added << " ... ";
+
+  const size_t slot = sizeof(RDMAObj<hydra::hash_table_entry>);
+  std::cout << "slot: " << slot << " bytes, neighbourhood read: "
+            << hop_range * slot << " bytes" << std::endl;
 
-  if(added != elems)
-    std::cout << "Aborted after " << added << std::endl;
-
-  std::cout << "Took "
-            << std::chrono::duration_cast<std::chrono::milliseconds>(gen_time)
-                   .count() << "ms to generate data" << std::endl;
-  std::cout << "Took "
-            << std::chrono::duration_cast<std::chrono::milliseconds>(add_time)
-                   .count() << "ms to add entries" << std::endl;
-
-  std::cout << added / std::chrono::duration_cast<std::chrono::milliseconds>(
-                           add_time + gen_time).count() << " kOps/s (gen + add)"
-            << std::endl;
-  std::cout << added / std::chrono::duration_cast<std::chrono::milliseconds>(
-                           add_time).count() << " kOps/s (add)" << std::endl;
+  volatile size_t sink = 0;
+  auto server = [&](const bytes_t &key) { sink = sink + contains(dht, key); };
+  std::cout << "contains: " << std::fixed << std::setprecision(1)
+            << ns_per_key(hits, server) << " ns/hit "
+            << ns_per_key(misses, server) << " ns/miss" << std::endl;
+
+  auto client = [&](const char *name, auto &&scan) {
+    std::cout << name;
+    for (auto &&keys : { &hits, &misses }) {
+      size_t compared = 0;
+      const double ns = ns_per_key(*keys, [&](const bytes_t &key) {
+        const size_t home =
+            hydra::reduce(hydra::hash(key.data(), key.size()), table_size);
+        /* neighbourhoods wrapping around are read in two parts */
+        if (home + hop_range > table_size)
+          return;
+        sink = sink + scan(table.data() + home, hop_range, key, compared);
+      });
+      std::cout << ns << " ns/" << (keys == &hits ? "hit " : "miss ")
+                << static_cast<double>(compared) / (5 * keys->size())
+                << " keys compared ";
+    }
+    std::cout << std::endl;
+  };
+  client("scan (hop bits): ", scan_hops);
+  client("scan (fingerprints): ", scan_fingerprints);
 }
 
+/* Insert throughput of one thread into tables which end up at a range of
+ * load factors; the fuller the table, the more entries are displaced.
+ */
+static void load_factors(const size_t hop_range, const size_t elems,
+                         const size_t size) {
+  for (const double load_factor : { 0.5, 0.6, 0.7, 0.8, 0.9, 0.95 }) {
+    const size_t table_size = static_cast<size_t>(elems / load_factor);
+    std::vector<LocalRDMAObj<hydra::hash_table_entry> > table(table_size);
+    hash_table_t dht(table.data(), hop_range, table_size);
+    auto requests = generate_requests(size, 0, elems);
 
-int main() {
+    std::cout << "Load factor " << std::setprecision(2) << load_factor
+              << " ... ";
+    size_t added = 0;
+    auto begin = std::chrono::high_resolution_clock::now();
+    for (; added < requests.size(); added++) {
+      if (add(dht, requests[added]) == hydra::NEED_RESIZE)
+        break;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (added != elems)
+      std::cout << "Aborted after " << added << " ... ";
+
+    const auto us =
+        std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+            .count();
+    std::cout << added * 1000 / std::max<decltype(us)>(us, 1)
+              << " kOps/s (add)" << std::endl;
+  }
+}
+
+/* Fill one node's table with the keys of its keyspace range, split into
+ * nodes equal ranges as fixed_network does, and report the load factor
+ * reached before the table asks to be resized. It should not drop with the
+ * number of nodes.
+ */
+static void partitioned(const size_t hop_range, const size_t elems,
+                        const size_t size) {
+  using value_type = hydra::keyspace_t::value_type;
+  for (const size_t nodes : { 1, 4, 16 }) {
+    const value_type last = std::numeric_limits<value_type>::max() / nodes;
+    std::vector<request_t> requests;
+    requests.reserve(elems);
+    for (size_t elem = 0; requests.size() < elems; elem++) {
+      std::ostringstream ss;
+      ss << std::setw(4) << elem;
+      const auto key = ss.str();
+      if (hydra::hash(key.c_str(), key.size()) <= last) {
+        auto request = generate_requests(size, elem, 1);
+        requests.push_back(std::move(request.front()));
+      }
+    }
+
+    const size_t table_size = static_cast<size_t>(elems / 0.95);
+    std::vector<LocalRDMAObj<hydra::hash_table_entry> > table(table_size);
+    hash_table_t dht(table.data(), hop_range, table_size);
+    size_t added = 0;
+    for (; added < requests.size(); added++) {
+      if (add(dht, requests[added]) == hydra::NEED_RESIZE)
+        break;
+    }
+    std::cout << nodes << " nodes: load factor " << std::setprecision(2)
+              << static_cast<double>(added) / table_size
+              << " before resizing" << std::endl;
+  }
+}
+
+/* Start with a small table and let it grow while inserting; resizes drain
+ * the old table incrementally and the next table is set up in the
+ * background, as node does, so the latency tail should stay flat.
+ */
+static void grow(const size_t hop_range, const size_t elems,
+                 const size_t size) {
+  using table_t = std::vector<LocalRDMAObj<hydra::hash_table_entry> >;
+  std::vector<std::unique_ptr<table_t> > tables;
+  tables.push_back(std::make_unique<table_t>(1024));
+  hash_table_t dht(tables.back()->data(), hop_range, tables.back()->size());
+
+  auto prepare = [&dht]() {
+#if STRIPED_LOCKS
+    const size_t next_size = dht.next_size();
+#else
+    const size_t next_size =
+        dht([](auto &&dht) { return dht.next_size(); });
+#endif
+    return std::async(std::launch::async, [&dht, next_size]() {
+      auto table = std::make_unique<table_t>(next_size);
+#if STRIPED_LOCKS
+      dht.prepare(table->data(), next_size);
+#else
+      dht([&table, next_size](auto &&dht) {
+        dht.prepare(table->data(), next_size);
+      });
+#endif
+      return table;
+    });
+  };
+
+  auto requests = generate_requests(size, 0, elems);
+  std::vector<std::chrono::nanoseconds> latencies;
+  latencies.reserve(elems);
+
+  auto next = prepare();
+  for (auto &&request : requests) {
+    auto begin = std::chrono::high_resolution_clock::now();
+    while (add(dht, request) == hydra::NEED_RESIZE) {
+      tables.push_back(next.get());
+#if STRIPED_LOCKS
+      const auto ret =
+          dht.resize(tables.back()->data(), tables.back()->size());
+#else
+      const auto ret = dht([&tables](auto &&dht) {
+        return dht.resize(tables.back()->data(), tables.back()->size());
+      });
+#endif
+      if (ret != hydra::SUCCESS) {
+        std::cerr << "Could not resize to " << tables.back()->size()
+                  << " entries" << std::endl;
+        return;
+      }
+      next = prepare();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    latencies.push_back(end - begin);
+  }
+  /* the table prepared last was not needed */
+  next.wait();
+
+  std::sort(std::begin(latencies), std::end(latencies));
+  auto percentile = [&](const double p) {
+    const size_t index = static_cast<size_t>(p * (latencies.size() - 1));
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               latencies[index]).count();
+  };
+  std::cout << "Growing to " << elems << " elements (" << tables.size() - 1
+            << " resizes): p50 " << percentile(0.5) << "us p99 "
+            << percentile(0.99) << "us p99.9 " << percentile(0.999)
+            << "us max " << percentile(1) << "us" << std::endl;
+}
+
+int main(int argc, const char *argv[]) {
   const size_t hop_range = 32;
-  const size_t table_size = 20000;
-  const size_t elems = 200000;
+  const size_t elems = 1000 * 1000;
+  const double load_factor = 0.8;
+  const size_t table_size = static_cast<size_t>(elems / load_factor);
   const size_t size = 64;
 
   const size_t min_threads = 1;
-  const size_t max_threads = 2;
-
-  static_assert(min_threads < max_threads, "The minimum number of threads must "
-                                           "be strictly smaller than the "
-                                           "maximum number");
+  const size_t max_threads =
+      (argc < 2) ? std::max(std::thread::hardware_concurrency(), 1U)
+                 : static_cast<size_t>(atoi(argv[1]));
 
-  for (size_t cur_threads = min_threads; cur_threads < max_threads;
+  /* The total number of elements is fixed and split among the threads, so
+   * the table ends up at the same load factor for every run.
+   */
+  for (size_t cur_threads = min_threads; cur_threads <= max_threads;
        cur_threads++) {
-    std::cout << "Running with " << cur_threads << " threads.";
+    std::cout << "Running with " << cur_threads << " threads ... ";
     std::cout.flush();
 
     std::vector<LocalRDMAObj<hydra::hash_table_entry> > table(table_size);
     hash_table_t dht(table.data(), hop_range, table_size);
 
+    const size_t per_thread = elems / cur_threads;
+    std::vector<std::vector<request_t> > requests;
+    for (size_t thread = 0; thread < cur_threads; thread++)
+      requests.push_back(
+          generate_requests(size, thread * per_thread, per_thread));
+
+    std::atomic_bool start(false);
+    std::vector<size_t> added(cur_threads, 0);
     std::vector<std::thread> threads;
     threads.reserve(cur_threads);
-    
-    auto start = std::chrono::high_resolution_clock::now();
-    
-    std::generate_n(std::back_inserter(threads), cur_threads, [&]() {
-      return std::thread(add, std::ref(dht), std::cref(size), std::cref(elems));
-    });
 
+    for (size_t thread = 0; thread < cur_threads; thread++) {
+      threads.emplace_back([&, thread]() {
+        add(dht, requests[thread], start, added[thread]);
+      });
+    }
+
+    auto begin = std::chrono::high_resolution_clock::now();
+    start = true;
     for (auto &&thread : threads) {
       thread.join();
     }
     auto end = std::chrono::high_resolution_clock::now();
 
-    std::cout << std::chrono::duration_cast<std::chrono::seconds>(end - start)
-                     .count() << "s" << std::endl;
-    std::cout << (elems * cur_threads) /
-                     std::chrono::duration_cast<std::chrono::milliseconds>(
-                         end - start).count() << " kOps/s (gen + add)"
-              << std::endl;
+    const size_t total = std::accumulate(std::begin(added), std::end(added), 0UL);
+    if (total != per_thread * cur_threads)
+      std::cout << "Aborted after " << total << " ... ";
+
+    const auto ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(end - begin)
+            .count();
+    std::cout << ms << "ms " << total / std::max<decltype(ms)>(ms, 1)
+              << " kOps/s (add)" << std::endl;
   }
-}
 
+  load_factors(hop_range, elems, size);
+  partitioned(hop_range, elems / 4, size);
+  lookups(hop_range, elems, table_size, size);
+  grow(hop_range, elems, size);
+}
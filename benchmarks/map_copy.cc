@@ -42,7 +42,7 @@ void bench_map(RDMAServerSocket &socket, size_t measurements, size_t max_size, s
 }
 
 void bench_small_alloc(RDMAServerSocket &socket, size_t measurements, size_t max_size, size_t step = 8) {
-  default_heap_t heap(48U, default_size_classes, socket);
+  default_heap_t heap(socket);
 
   for (size_t size = step; size < max_size; size += step) {
     size_t min = std::numeric_limits<size_t>::max();
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include <assert.h>
+
+#include "hydra/types.h"
+#include "hydra/validation.h"
+
+/* Cost per byte of validating key/values (verifying_ptr) and of updating and
+ * validating objects (RDMAObj), for each checksum and validation policy.
+ */
+
+static constexpr size_t min_size = 64;
+static constexpr size_t max_size = 64 * 1024;
+/* bytes processed per measurement */
+static constexpr size_t volume = 256 * 1024 * 1024;
+
+template <typename F> static double ns_per_byte(const size_t size, F &&f) {
+  const size_t iterations = volume / size;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t i = 0; i < iterations; i++)
+    f();
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         static_cast<double>(volume);
+}
+
+template <typename Checksum>
+static void checksum(const char *name, const std::vector<unsigned char> &data,
+                     const size_t size) {
+  volatile uint64_t sink = 0;
+  const double ns = ns_per_byte(
+      size, [&]() { sink = sink + Checksum::checksum(data.data(), size); });
+  std::cout << std::setw(10) << name << std::setw(8) << size << std::fixed
+            << std::setprecision(4) << std::setw(10) << ns << " ns/B"
+            << std::endl;
+}
+
+/* an update in place, as LocalRDMAObj::operator() does, and a validation of
+ * the object by a reader
+ */
+template <typename Validation, size_t size> static void object(const char *name) {
+  using object_t = LocalRDMAObj<std::array<unsigned char, size>, Validation>;
+  std::unique_ptr<object_t> o(new object_t());
+  volatile bool sink = true;
+  const double ns = ns_per_byte(size, [&]() {
+    (*o)([](auto &obj) { obj[0]++; });
+    sink = sink && o->valid();
+  });
+  assert(sink);
+  std::cout << std::setw(10) << name << std::setw(8) << size << std::fixed
+            << std::setprecision(4) << std::setw(10) << ns << " ns/B"
+            << std::endl;
+}
+
+template <size_t size> static void objects() {
+  object<hydra::checksum_validation<hydra::city_checksum>, size>("city obj");
+  object<hydra::checksum_validation<hydra::crc32c_checksum>, size>(
+      "crc32c obj");
+  object<hydra::seqlock_validation, size>("seqlock");
+  objects<size * 4>();
+}
+
+template <> void objects<max_size * 4>() {}
+
+/* A reader copying an object while it is written takes version, obj and
+ * trailer, in this order, from any of the states the writer goes through.
+ * Returns whether no torn copy passes as valid.
+ */
+static bool seqlock_untorn() {
+  using layout_t =
+      hydra::seqlock_validation::layout<std::array<unsigned char, min_size> >;
+  layout_t o(hydra::construct);
+  std::vector<layout_t> states(1, o);
+  o.begin();
+  states.push_back(o);
+  const size_t torn = states.size();
+  std::fill(o.obj.begin(), o.obj.begin() + min_size / 2, 1);
+  states.push_back(o);
+  std::fill(o.obj.begin() + min_size / 2, o.obj.end(), 1);
+  states.push_back(o);
+  o.seal();
+  states.push_back(o);
+
+  if (!states.front().valid() || !states.back().valid())
+    return false;
+  for (size_t v = 0; v < states.size(); v++) {
+    for (size_t obj = v; obj < states.size(); obj++) {
+      for (size_t t = obj; t < states.size(); t++) {
+        layout_t copy = states[t];
+        copy.version = states[v].version;
+        copy.obj = states[obj].obj;
+        if (obj == torn && copy.valid())
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  /* check value of CRC32C */
+  const unsigned char check[] = "123456789";
+  if (hydra::crc32c_checksum::checksum(check, 9) != 0xe3069283) {
+    std::cerr << "CRC32C is broken" << std::endl;
+    return 1;
+  }
+  if (!seqlock_untorn()) {
+    std::cerr << "seqlock validation accepts torn copies" << std::endl;
+    return 1;
+  }
+
+  std::mt19937_64 generator;
+  std::uniform_int_distribution<unsigned char> distribution;
+  std::vector<unsigned char> data(max_size);
+  std::generate(std::begin(data), std::end(data),
+                [&]() { return distribution(generator); });
+
+  for (size_t size = min_size; size <= max_size; size *= 4) {
+    checksum<hydra::city_checksum>("city", data, size);
+    checksum<hydra::crc32c_checksum>("crc32c", data, size);
+  }
+  objects<min_size>();
+}
@@ -1,16 +1,351 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
 #include <memory>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
 #include <rdma/rdma_verbs.h>
 
 #include "util/utils.h"
 #include "allocators/config.h"
+#include "allocators/HeapStats.h"
 
 #include "rdma/RDMAWrapper.hpp"
 
+/* Carve allocations from large, once-registered regions. Set to 0 to mmap and
+ * register every allocation separately.
+ */
+#define RDMA_ARENA 1
+
+namespace hydra {
+/* Memory regions registered by RdmaHeap, over all heaps. */
+struct rdma_heap_stats {
+  std::atomic<size_t> registrations;
+  std::atomic<size_t> registered_bytes;
+  std::atomic<size_t> allocations;
+
+  static rdma_heap_stats &instance() {
+    static rdma_heap_stats stats{ { 0 }, { 0 }, { 0 } };
+    return stats;
+  }
+};
+
+/* How an rdma_arena backs its regions. */
+struct rdma_pool_config {
+  /* device_node is resolved by the owner of the RDMA device */
+  enum : int { any_node = -1, device_node = -2 };
+  /* 1 GiB or 2 MiB pages if reserved, transparent huge pages otherwise */
+  bool huge_pages = true;
+  /* fault every page in when a region is mapped, not on first use */
+  bool prefault = true;
+  /* NUMA node to bind regions to */
+  int numa_node = any_node;
+  /* mapped, bound, faulted in and registered up front */
+  size_t reserve = 0;
+};
+
+/* Large regions, each registered once, handed out in page-aligned spans. All
+ * spans of a region share its memory region and thus its rkey. Regions are
+ * backed by 1 GiB or 2 MiB huge pages if the system has them reserved and by
+ * transparent huge pages otherwise. Freed spans are merged with free
+ * neighbours of the same region, or given back to the unallocated end of it,
+ * and allocations take the smallest free span which fits, splitting it. Tables
+ * growing by a factor thus reuse the merged spans of the tables before them.
+ * Regions are released with the arena.
+ *
+ * HYDRA_ARENA_REGION_MB overrides the default region size. rdma_pool_config
+ * changes the backing of regions mapped from then on.
+ */
+class rdma_arena {
+public:
+  using registrar_t = std::function<mr_t(void *, size_t)>;
+  using span_t = std::pair<char *, ibv_mr *>;
+  static constexpr size_t page_size = 4096;
+
+  rdma_arena(registrar_t registrar, const size_t region_size)
+      : registrar(std::move(registrar)), region_size(region_size) {}
+  rdma_arena(const rdma_arena &) = delete;
+  ~rdma_arena() {
+    for (auto &&r : regions) {
+      r.mr.reset();
+      ::munmap(r.base, r.mapped);
+    }
+  }
+
+  /* one arena per registrar and access flags */
+  static std::shared_ptr<rdma_arena> get(const void *key,
+                                         const ibv_access access,
+                                         registrar_t registrar) {
+    static std::mutex mutex;
+    static std::map<std::pair<const void *, int>, std::weak_ptr<rdma_arena> >
+        arenas;
+
+    std::unique_lock<std::mutex> l(mutex);
+    auto &entry = arenas[std::make_pair(key, static_cast<int>(access))];
+    auto arena = entry.lock();
+    if (!arena) {
+      arena = std::make_shared<rdma_arena>(std::move(registrar),
+                                           default_region_size());
+      entry = arena;
+    }
+    return arena;
+  }
+
+  /* Sets up the arena of key before the heaps using it allocate. */
+  static std::shared_ptr<rdma_arena> get(const void *key,
+                                         const ibv_access access,
+                                         registrar_t registrar,
+                                         const rdma_pool_config &config) {
+    auto arena = get(key, access, std::move(registrar));
+    arena->configure(config);
+    arena->reserve(config.reserve);
+    return arena;
+  }
+
+  void configure(const rdma_pool_config &config) {
+    std::unique_lock<std::mutex> l(mutex);
+    this->config = config;
+  }
+
+  /* Makes sure size bytes can be allocated without mapping a region. */
+  void reserve(const size_t size) {
+    if (size == 0)
+      return;
+    std::unique_lock<std::mutex> l(mutex);
+    if (regions.empty() || regions.back().size - regions.back().used < size)
+      expand(round_up(size, page_size), true);
+  }
+
+  static size_t default_region_size() {
+    if (const char *env = getenv("HYDRA_ARENA_REGION_MB"))
+      return std::stoull(env) * 1024 * 1024;
+    return 256 * 1024 * 1024;
+  }
+
+  span_t allocate(size_t size) {
+    size = round_up(size, page_size);
+    std::unique_lock<std::mutex> l(mutex);
+    auto it = free_by_size.lower_bound(
+        std::make_pair(size, static_cast<char *>(nullptr)));
+    if (it != free_by_size.end()) {
+      char *p = it->second;
+      const size_t free_size = it->first;
+      ibv_mr *mr = free_by_address.at(p).second;
+      unlink(p, free_size);
+      if (free_size > size)
+        link(p + size, free_size - size, mr);
+      return span_t(p, mr);
+    }
+
+    /* the end of another region may have been given back */
+    auto r = std::find_if(regions.begin(), regions.end(), [=](auto &&r) {
+      return r.size - r.used >= size;
+    });
+    if (r == regions.end()) {
+      expand(size);
+      r = std::prev(regions.end());
+    }
+
+    span_t span(r->base + r->used, r->mr.get());
+    r->used += size;
+    return span;
+  }
+
+  void deallocate(void *ptr, size_t size) {
+    char *p = static_cast<char *>(ptr);
+    size = round_up(size, page_size);
+    std::unique_lock<std::mutex> l(mutex);
+    /* there are only a handful of regions */
+    for (auto &&r : regions) {
+      if (p >= r.base && p < r.base + r.size) {
+        auto next = free_by_address.lower_bound(p);
+        if (next != free_by_address.end() && next->first == p + size &&
+            next->second.second == r.mr.get()) {
+          const size_t next_size = next->second.first;
+          unlink(p + size, next_size);
+          size += next_size;
+        }
+        auto prev = free_by_address.lower_bound(p);
+        if (prev != free_by_address.begin()) {
+          --prev;
+          if (prev->first + prev->second.first == p &&
+              prev->second.second == r.mr.get()) {
+            const size_t prev_size = prev->second.first;
+            p = prev->first;
+            unlink(p, prev_size);
+            size += prev_size;
+          }
+        }
+        if (p + size != r.base + r.used) {
+          link(p, size, r.mr.get());
+        } else if ((r.used -= size) == 0 && !r.reserved &&
+                   r.size > region_size) {
+          release(r);
+        }
+        return;
+      }
+    }
+    assert(false);
+  }
+
+  /* number of memory regions, i.e. rkeys, the NIC has to track */
+  size_t region_count() const {
+    std::unique_lock<std::mutex> l(mutex);
+    return regions.size();
+  }
+
+  heap_stats::registration usage() const {
+    heap_stats::registration usage = { 0, 0, 0, 0 };
+    std::unique_lock<std::mutex> l(mutex);
+    usage.regions = regions.size();
+    for (auto &&r : regions) {
+      usage.bytes += r.size;
+      usage.used += r.used;
+    }
+    usage.free = free_bytes;
+    return usage;
+  }
+
+private:
+  struct region {
+    char *base;
+    size_t size;
+    size_t mapped;
+    size_t used;
+    mr_t mr;
+    /* mapped by reserve(), kept even if empty */
+    bool reserved;
+  };
+
+  /* callers hold mutex */
+  void link(char *p, const size_t size, ibv_mr *mr) {
+    free_by_address.emplace(p, std::make_pair(size, mr));
+    free_by_size.emplace(size, p);
+    free_bytes += size;
+  }
+  void unlink(char *p, const size_t size) {
+    free_by_address.erase(p);
+    free_by_size.erase(std::make_pair(size, p));
+    free_bytes -= size;
+  }
+
+  static size_t round_up(const size_t size, const size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+  void *map(size_t &size) const {
+    static constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *ptr = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    static constexpr size_t huge_1g = 1UL << 30;
+    static constexpr size_t huge_2m = 1UL << 21;
+    if (config.huge_pages && size % huge_1g == 0)
+      ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 flags | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+    if (config.huge_pages && ptr == MAP_FAILED) {
+      const size_t huge_size = round_up(size, huge_2m);
+      ptr = mmap(nullptr, huge_size, PROT_READ | PROT_WRITE,
+                 flags | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+      if (ptr != MAP_FAILED)
+        size = huge_size;
+    }
+#endif
+    if (ptr == MAP_FAILED) {
+      ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+      if (ptr == MAP_FAILED)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+      if (config.huge_pages)
+        madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+    }
+    bind(ptr, size);
+    if (config.prefault)
+      prefault(ptr, size);
+    return ptr;
+  }
+
+  /* before the first touch, which places the pages */
+  void bind(void *ptr, const size_t size) const {
+    if (config.numa_node < 0)
+      return;
+    static constexpr size_t bits = std::numeric_limits<unsigned long>::digits;
+    unsigned long mask[1024 / bits] = {};
+    const size_t node = static_cast<size_t>(config.numa_node);
+    if (node >= 1024)
+      return;
+    mask[node / bits] |= 1UL << (node % bits);
+    if (syscall(SYS_mbind, ptr, size, MPOL_BIND, mask, 1024, 0) != 0)
+      log_warn() << "Binding region to NUMA node " << node
+                 << " failed: " << strerror(errno);
+  }
+
+  static void prefault(void *ptr, const size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(ptr, size, MADV_POPULATE_WRITE) == 0)
+      return;
+#endif
+    volatile char *p = static_cast<char *>(ptr);
+    for (size_t offset = 0; offset < size; offset += page_size)
+      p[offset] = 0;
+  }
+
+  void expand(const size_t size, const bool reserved = false) {
+    size_t mapped = std::max(size, region_size);
+    char *base = static_cast<char *>(map(mapped));
+    try {
+      auto mr = registrar(base, mapped);
+      auto &stats = rdma_heap_stats::instance();
+      stats.registrations++;
+      stats.registered_bytes += mapped;
+      log_info() << "Registered arena region of " << (mapped >> 20)
+                 << " MiB, " << regions.size() + 1 << " region(s)";
+      regions.push_back({ base, mapped, mapped, 0, std::move(mr), reserved });
+    }
+    catch (...) {
+      ::munmap(base, mapped);
+      throw;
+    }
+  }
+
+  /* Regions larger than region_size were mapped for a single allocation, which
+   * a later one of the same size is unlikely to reuse. Once empty, they are
+   * deregistered and unmapped.
+   */
+  void release(region &r) {
+    log_info() << "Released arena region of " << (r.mapped >> 20) << " MiB";
+    r.mr.reset();
+    ::munmap(r.base, r.mapped);
+    regions.erase(regions.begin() + (&r - regions.data()));
+  }
+
+  registrar_t registrar;
+  const size_t region_size;
+  rdma_pool_config config;
+  mutable std::mutex mutex;
+  std::vector<region> regions;
+  /* free spans, by address with their size and region, and by size */
+  std::map<char *, std::pair<size_t, ibv_mr *> > free_by_address;
+  std::set<std::pair<size_t, char *> > free_by_size;
+  size_t free_bytes = 0;
+};
+}
+
 template <ibv_access access = ibv_access::READ> class RdmaHeap {
 public:
   enum {
@@ -26,6 +361,13 @@ public:
       : self_(new rdma_allocator_model<T>(rdma_instance)) {
     static_assert(is_power_of_two<Alignment>::value,
                   "Alignment must be power of two");
+#if RDMA_ARENA
+    auto self = self_;
+    arena_ = hydra::rdma_arena::get(
+        &rdma_instance, access, [self](void *ptr, size_t size) {
+          return self->register_memory(access, ptr, size);
+        });
+#endif
   }
 
   /* Maybe do something like:
@@ -33,6 +375,23 @@ public:
    * alloc_type malloc(size_t size, const T& registrar) {...}
    * but then, the registrar has to be dragged to all heap layers...
    */
+#if RDMA_ARENA
+  /* Spans must not outlive the heap, same as with ZoneHeap. */
+  template <typename T> rdma_ptr<T> malloc(size_t size = sizeof(T)) {
+    auto span = arena_->allocate(size);
+    hydra::rdma_heap_stats::instance().allocations++;
+    hydra::rdma_arena *arena = arena_.get();
+    return rdma_ptr<T>(pointer_t<T>(reinterpret_cast<T *>(span.first),
+                                    [=](void *p) {
+                                      arena->deallocate(p, size);
+                                    }),
+                       span.second);
+  }
+
+  void stats(hydra::heap_stats &s) {
+    s.registered[arena_.get()] = arena_->usage();
+  }
+#else
   template <typename T> rdma_ptr<T> malloc(size_t size = sizeof(T)) {
     T *ptr = reinterpret_cast<T *>(mmap(nullptr, size, PROT_READ | PROT_WRITE,
                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
@@ -40,6 +399,10 @@ public:
       throw std::bad_alloc();
     try {
       auto mr = self_->register_memory(access, ptr, size);
+      auto &stats = hydra::rdma_heap_stats::instance();
+      stats.registrations++;
+      stats.registered_bytes += size;
+      stats.allocations++;
       /* retain pointer before moving the unique_ptr into the deleter lambda
        * edit: we cant reset the pointer in the lambda because it may be mutable
        * thus call rdma_dereg_mr in the lambda on the raw-pointer and release
@@ -62,6 +425,14 @@ public:
     }
   }
 
+  /* registrations of all heaps since startup, they are not counted down */
+  void stats(hydra::heap_stats &s) {
+    auto &stats = hydra::rdma_heap_stats::instance();
+    s.registered[nullptr] = { stats.registrations, stats.registered_bytes,
+                              stats.registered_bytes, 0 };
+  }
+#endif
+
 private:
   struct rdma_allocator_concept {
     virtual ~rdma_allocator_concept() = default;
@@ -79,5 +450,8 @@ private:
   };
 
   std::shared_ptr<const rdma_allocator_concept> self_;
+#if RDMA_ARENA
+  std::shared_ptr<hydra::rdma_arena> arena_;
+#endif
 };
 
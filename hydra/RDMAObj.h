@@ -2,54 +2,76 @@
 
 #include <stdint.h>
 #include "hydra/hash.h"
+#include "hydra/validation.h"
+
+/* The layout, and how copies read over RDMA are validated, is up to
+ * Validation; see hydra/validation.h.
+ */
+template <typename T,
+          typename Validation = typename hydra::validation_of<T>::type>
+class RDMAObj : protected Validation::template layout<T> {
+  using layout_t = typename Validation::template layout<T>;
 
-template <typename T> class RDMAObj {
 protected:
-  T obj;
-  uint64_t crc;
+  using layout_t::obj;
 
 public:
-  RDMAObj() : crc(hydra::hash64(&obj)) {}
+  RDMAObj() : layout_t(hydra::construct) {}
   template <typename T1, typename... Args,
-            typename std::enable_if<not_self<T1, RDMAObj<T> >::value>::type * =
+            typename std::enable_if<not_self<T1, RDMAObj>::value>::type * =
                 nullptr>
   RDMAObj(T1 arg0, Args &&... args)
-      : obj(std::forward<T1>(arg0), std::forward<Args>(args)...),
-        crc(hydra::hash64(&obj)) {}
-  RDMAObj(const RDMAObj<T> &other) = default;
-  RDMAObj<T> &operator=(const RDMAObj<T> &other) = default;
-  RDMAObj(RDMAObj<T> &&other)
-      : obj(std::move(other.obj)), crc(hydra::hash64(&obj)) {
+      : layout_t(hydra::construct, std::forward<T1>(arg0),
+                 std::forward<Args>(args)...) {}
+  RDMAObj(const RDMAObj &other) = default;
+  /* T may not copy all of itself (hash_table_entry keeps its hop word) */
+  RDMAObj &operator=(const RDMAObj &other) {
+    layout_t::begin();
+    obj = other.obj;
+    layout_t::seal();
+    return *this;
+  }
+  RDMAObj(RDMAObj &&other)
+      : layout_t(hydra::construct, std::move(other.obj)) {
     other.rehash();
   }
-  RDMAObj<T> &operator=(RDMAObj<T> &&other) {
+  RDMAObj &operator=(RDMAObj &&other) {
+    layout_t::begin();
     obj = std::move(other.obj);
+    layout_t::seal();
     other.rehash();
-    rehash();
     return *this;
   }
 
-  void rehash() { crc = hydra::hash64(&obj); }
-  bool valid() const { return hydra::hash64(&obj) == crc; }
+  void rehash() {
+    layout_t::begin();
+    layout_t::seal();
+  }
+  using layout_t::valid;
   const T &get() const { return obj; }
 };
 
-template <typename T> class LocalRDMAObj : public RDMAObj<T> {
+template <typename T,
+          typename Validation = typename hydra::validation_of<T>::type>
+class LocalRDMAObj : public RDMAObj<T, Validation> {
+  using base = RDMAObj<T, Validation>;
 
   template <typename F> void void_helper(F &&f, std::true_type) {
-    f(RDMAObj<T>::obj);
-    RDMAObj<T>::rehash();
+    base::begin();
+    f(base::obj);
+    base::seal();
   }
 
   template <typename F> auto void_helper(F &&f, std::false_type) {
-    auto ret = f(RDMAObj<T>::obj);
-    RDMAObj<T>::rehash();
+    base::begin();
+    auto ret = f(base::obj);
+    base::seal();
     return ret;
   }
 
 public:
-  using RDMAObj<T>::RDMAObj;
-  using RDMAObj<T>::operator=;
+  using RDMAObj<T, Validation>::RDMAObj;
+  using RDMAObj<T, Validation>::operator=;
 
   template <typename F> auto operator()(F &&f) {
     return void_helper(std::forward<F>(f),
@@ -59,9 +81,9 @@ public:
 
 namespace hydra {
 namespace rdma {
-template <typename Socket, typename T>
-void load(const Socket &s, RDMAObj<T> &o, const ibv_mr *mr, uintptr_t remote,
-          uint32_t rkey, size_t retries = 1) {
+template <typename Socket, typename T, typename Validation>
+void load(const Socket &s, RDMAObj<T, Validation> &o, const ibv_mr *mr,
+          uintptr_t remote, uint32_t rkey, size_t retries = 1) {
   do {
     s.read(o, mr, remote, rkey);
     retries--;
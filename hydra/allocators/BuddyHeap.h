@@ -0,0 +1,267 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+
+#include "util/concurrent.h"
+#include "util/utils.h"
+#include "allocators/HeapStats.h"
+
+namespace hydra {
+
+/* Buddy allocator over chunks of registered memory. Blocks are powers of two
+ * between minSize and chunkSize; a freed block is merged with its buddy if that
+ * is free as well. Larger requests are passed on to SuperHeap. Chunks are kept
+ * for the lifetime of the heap.
+ *
+ * Freed blocks are reused right away. Memory which remote peers may still be
+ * reading has to go through an epoch_reclaimer first.
+ */
+template <typename SuperHeap, size_t chunkSize, size_t minSize = 64>
+class BuddyHeap : public SuperHeap {
+  static_assert(is_power_of_two<chunkSize>::value,
+                "chunkSize must be a power of two");
+  static_assert(is_power_of_two<minSize>::value,
+                "minSize must be a power of two");
+  static_assert(minSize >= 2 * sizeof(void *),
+                "Free blocks need to hold two pointers");
+  static_assert(chunkSize >= minSize, "chunkSize must not be below minSize");
+
+  static constexpr size_t min_order = hydra::util::static_log2<minSize>::value;
+  static constexpr size_t max_order =
+      hydra::util::static_log2<chunkSize>::value;
+  static constexpr size_t orders = max_order - min_order + 1;
+
+public:
+  template <typename T>
+  using pointer_t = typename SuperHeap::template pointer_t<T>;
+  template <typename T>
+  using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
+
+private:
+  /* threaded through free blocks, which nobody reads anymore */
+  struct free_block {
+    free_block *prev;
+    free_block *next;
+  };
+
+  struct chunk {
+    rdma_ptr<char> mem;
+    /* order of the free block starting at each minSize block, -1 if none */
+    std::vector<int8_t> free_order;
+
+    chunk(rdma_ptr<char> mem)
+        : mem(std::move(mem)), free_order(chunkSize / minSize, -1) {}
+    char *base() const { return mem.first.get(); }
+  };
+
+  std::map<char *, std::unique_ptr<chunk> > chunks;
+  free_block *free_lists[orders];
+  std::unordered_map<char *, rdma_ptr<char> > large;
+  spinlock lock;
+
+  /* under lock */
+  size_t free_blocks[orders];
+  size_t live_blocks[orders];
+  size_t requested = 0;
+  size_t allocated = 0;
+
+public:
+  template <typename... Args>
+  BuddyHeap(Args &&... args)
+      : SuperHeap(std::forward<Args>(args)...) {
+    std::fill(std::begin(free_lists), std::end(free_lists), nullptr);
+    std::fill(std::begin(free_blocks), std::end(free_blocks), 0);
+    std::fill(std::begin(live_blocks), std::end(live_blocks), 0);
+  }
+
+  BuddyHeap(const BuddyHeap &) = delete;
+  BuddyHeap(BuddyHeap &&) = delete;
+
+  template <typename T> inline rdma_ptr<T> malloc(const size_t n_elems = 1) {
+    const size_t size = std::max<size_t>(n_elems * sizeof(T), 1);
+
+    if (size > chunkSize)
+      return malloc_large<T>(size);
+
+    const size_t order = order_of(size);
+    char *p;
+    ibv_mr *mr;
+    {
+      std::unique_lock<spinlock> l(lock);
+      std::tie(p, mr) = take(order);
+      account(size, order, true);
+    }
+
+    /* keeps the deleter within the small buffer of std::function */
+    const size_t packed = (size << OrderBits) | order;
+    return rdma_ptr<T>(
+        pointer_t<T>(reinterpret_cast<T *>(p), [this, packed](T *p) {
+          const size_t order = packed & ((size_t(1) << OrderBits) - 1);
+          std::unique_lock<spinlock> l(lock);
+          account(packed >> OrderBits, order, false);
+          insert(reinterpret_cast<char *>(p), order);
+        }),
+        mr);
+  }
+
+  /* Memory taken from SuperHeap in chunks, not counting large blocks. */
+  size_t footprint() const { return chunks.size() * chunkSize; }
+
+  /* one class per order, followed by those of SuperHeap */
+  void stats(hydra::heap_stats &s) {
+    {
+      std::unique_lock<spinlock> l(lock);
+      s.requested += requested;
+      s.allocated += allocated;
+      for (size_t i = 0; i < orders; i++) {
+        const size_t size = size_t(1) << (i + min_order);
+        s.classes.push_back(
+            { size, live_blocks[i] + free_blocks[i], free_blocks[i] });
+        s.blocks += live_blocks[i] + free_blocks[i];
+        s.free_blocks += free_blocks[i];
+        s.free_bytes += free_blocks[i] * size;
+      }
+    }
+    SuperHeap::stats(s);
+  }
+
+private:
+  enum { OrderBits = 8 };
+
+  /* caller holds lock */
+  void account(const size_t size, const size_t order, const bool live) {
+    const size_t block = size_t(1) << order;
+    if (live) {
+      requested += size;
+      allocated += block;
+      live_blocks[order - min_order]++;
+    } else {
+      requested -= size;
+      allocated -= block;
+      live_blocks[order - min_order]--;
+    }
+  }
+
+  static size_t order_of(const size_t size) {
+    if (size <= minSize)
+      return min_order;
+    return hydra::util::log2(size - 1) + 1;
+  }
+
+  template <typename T> rdma_ptr<T> malloc_large(const size_t size) {
+    auto mem = SuperHeap::template malloc<char>(size);
+    char *p = mem.first.get();
+    ibv_mr *mr = mem.second;
+    {
+      std::unique_lock<spinlock> l(lock);
+      large.emplace(p, std::move(mem));
+      requested += size;
+      allocated += size;
+    }
+    return rdma_ptr<T>(
+        pointer_t<T>(reinterpret_cast<T *>(p), [this, size](T *p) {
+          rdma_ptr<char> mem;
+          {
+            std::unique_lock<spinlock> l(lock);
+            requested -= size;
+            allocated -= size;
+            auto it = large.find(reinterpret_cast<char *>(p));
+            mem = std::move(it->second);
+            large.erase(it);
+          }
+          /* returns the memory to SuperHeap */
+        }),
+        mr);
+  }
+
+  chunk &chunk_of(char *p) {
+    auto it = chunks.upper_bound(p);
+    assert(it != chunks.begin());
+    --it;
+    assert(p < it->first + chunkSize);
+    return *it->second;
+  }
+
+  size_t index(const chunk &c, const char *p) const {
+    return static_cast<size_t>(p - c.base()) >> min_order;
+  }
+
+  void push(chunk &c, char *p, const size_t order) {
+    free_block *block = reinterpret_cast<free_block *>(p);
+    free_block *&head = free_lists[order - min_order];
+    block->prev = nullptr;
+    block->next = head;
+    if (head)
+      head->prev = block;
+    head = block;
+    c.free_order[index(c, p)] = static_cast<int8_t>(order);
+    free_blocks[order - min_order]++;
+  }
+
+  void unlink(chunk &c, char *p, const size_t order) {
+    free_block *block = reinterpret_cast<free_block *>(p);
+    if (block->prev)
+      block->prev->next = block->next;
+    else
+      free_lists[order - min_order] = block->next;
+    if (block->next)
+      block->next->prev = block->prev;
+    c.free_order[index(c, p)] = -1;
+    free_blocks[order - min_order]--;
+  }
+
+  void expand() {
+    auto c = std::make_unique<chunk>(
+        SuperHeap::template malloc<char>(chunkSize));
+    char *base = c->base();
+    chunk &ref = *c;
+    chunks.emplace(base, std::move(c));
+    push(ref, base, max_order);
+  }
+
+  /* caller holds lock */
+  std::pair<char *, ibv_mr *> take(const size_t order) {
+    size_t k = order;
+    while (k <= max_order && free_lists[k - min_order] == nullptr)
+      k++;
+    if (k > max_order) {
+      expand();
+      k = max_order;
+    }
+
+    char *p = reinterpret_cast<char *>(free_lists[k - min_order]);
+    chunk &c = chunk_of(p);
+    unlink(c, p, k);
+    /* split, keeping the lower half */
+    while (k > order) {
+      k--;
+      push(c, p + (size_t(1) << k), k);
+    }
+    return { p, c.mem.second };
+  }
+
+  /* caller holds lock */
+  void insert(char *p, size_t order) {
+    chunk &c = chunk_of(p);
+    size_t offset = static_cast<size_t>(p - c.base());
+    while (order < max_order) {
+      const size_t buddy = offset ^ (size_t(1) << order);
+      if (c.free_order[buddy >> min_order] != static_cast<int8_t>(order))
+        break;
+      unlink(c, c.base() + buddy, order);
+      offset = std::min(offset, buddy);
+      order++;
+    }
+    push(c, c.base() + offset, order);
+  }
+};
+}
@@ -34,6 +34,8 @@
  * meaning that such objects must be at least the size of a pointer.
  */
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 #include <utility>
 #include <assert.h>
@@ -41,6 +43,7 @@
 #include <memory>
 
 #include "util/concurrent.h"
+#include "allocators/HeapStats.h"
 
 namespace hydra {
 
@@ -67,6 +70,8 @@ public:
         p = freelist.back().first;
         mr = freelist.back().second;
         freelist.pop_back();
+        if (freelist.empty())
+          update_hint();
       }
     }
     if (p == nullptr) {
@@ -74,6 +79,7 @@ public:
       p = alloc.first.get();
       mr = alloc.second;
       allocs.push_back(std::move(alloc));
+      block_size = std::max(block_size, size);
     }
     return make_pointer<T>(p, mr);
   }
@@ -123,6 +129,40 @@ public:
         mr_type(ptr.second));
   }
 #endif
+
+  /* Reuses a freed block, but does not ask SuperHeap for memory. */
+  template <typename T> inline rdma_ptr<T> try_malloc() {
+    std::unique_lock<decltype(freelist_lock)> l(freelist_lock);
+    if (freelist.empty())
+      return rdma_ptr<T>(pointer_t<T>(nullptr), nullptr);
+    char *p = freelist.back().first;
+    ibv_mr *mr = freelist.back().second;
+    freelist.pop_back();
+    if (freelist.empty())
+      update_hint();
+    l.unlock();
+    return make_pointer<T>(p, mr);
+  }
+
+  /* Keeps mask set in *hint while there are free blocks. */
+  void set_free_hint(std::atomic<size_t> *hint, const size_t mask) {
+    free_hint = hint;
+    free_hint_mask = mask;
+  }
+
+  /* Free bytes assume all blocks are as large as the largest one. */
+  void stats(hydra::heap_stats &s) {
+    size_t free;
+    {
+      std::unique_lock<decltype(freelist_lock)> l(freelist_lock);
+      free = freelist.size();
+    }
+    s.blocks += allocs.size();
+    s.free_blocks += free;
+    s.free_bytes += free * block_size;
+    SuperHeap::stats(s);
+  }
+
 private:
   using freelist_t = std::vector<std::pair<char *, ibv_mr *> >;
 
@@ -131,13 +171,28 @@ private:
                          std::unique_lock<decltype(freelist_lock)> l(freelist_lock);
                          freelist.emplace_back(reinterpret_cast<char *>(p),
                                                 mr);
+                         if (freelist.size() == 1)
+                           update_hint();
                        }),
                        mr);
   }
 
+  /* caller holds freelist_lock */
+  void update_hint() {
+    if (free_hint == nullptr)
+      return;
+    if (freelist.empty())
+      free_hint->fetch_and(~free_hint_mask, std::memory_order_relaxed);
+    else
+      free_hint->fetch_or(free_hint_mask, std::memory_order_release);
+  }
+
   std::vector<rdma_ptr<char> > allocs;
+  size_t block_size = 0;
   freelist_t freelist;
   spinlock freelist_lock;
+  std::atomic<size_t> *free_hint = nullptr;
+  size_t free_hint_mask = 0;
 
 };
 }
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <vector>
+
+namespace hydra {
+
+/* Footprint of a stack of heap layers. Every layer provides
+ *   void stats(heap_stats &s);
+ * which adds what the layer itself holds and passes s on to the layer below,
+ * so that each byte is counted by one layer only: a block on a free list is
+ * free_bytes of the free list, not unused of the ZoneHeap it came from.
+ *
+ * Registered memory is shared by all heaps of a socket. It is recorded per
+ * arena, so that it is counted once no matter how many heaps report it.
+ */
+struct heap_stats {
+  struct size_class {
+    /* largest request of the class */
+    size_t size;
+    /* taken from the layer below, free or in use */
+    size_t blocks;
+    size_t free_blocks;
+  };
+
+  struct registration {
+    size_t regions;
+    size_t bytes;
+    /* handed out to heaps, including freed spans */
+    size_t used;
+    /* freed spans, kept for reuse */
+    size_t free;
+  };
+
+  /* live allocations, as requested and after rounding (BuddyHeap) */
+  size_t requested = 0;
+  size_t allocated = 0;
+  /* blocks of free list layers, and the freed ones kept for reuse */
+  size_t blocks = 0;
+  size_t free_blocks = 0;
+  size_t free_bytes = 0;
+  /* freed by their owner, but never reused (ZoneHeap) */
+  size_t abandoned = 0;
+  /* lost to rounding sizes up to the alignment (ZoneHeap) */
+  size_t alignment = 0;
+  /* taken from the layer below, but not handed out yet (ZoneHeap) */
+  size_t unused = 0;
+  /* filled in by heaps which have size classes */
+  std::vector<size_class> classes;
+  /* by arena */
+  std::map<const void *, registration> registered;
+
+  heap_stats &operator+=(const heap_stats &other) {
+    requested += other.requested;
+    allocated += other.allocated;
+    blocks += other.blocks;
+    free_blocks += other.free_blocks;
+    free_bytes += other.free_bytes;
+    abandoned += other.abandoned;
+    alignment += other.alignment;
+    unused += other.unused;
+    classes.insert(classes.end(), other.classes.begin(), other.classes.end());
+    registered.insert(other.registered.begin(), other.registered.end());
+    return *this;
+  }
+
+  size_t regions() const {
+    size_t n = 0;
+    for (auto &&r : registered)
+      n += r.second.regions;
+    return n;
+  }
+
+  size_t registered_bytes() const {
+    size_t bytes = 0;
+    for (auto &&r : registered)
+      bytes += r.second.bytes;
+    return bytes;
+  }
+
+  /* held by the heaps but not in use by anyone */
+  size_t wasted() const {
+    return free_bytes + abandoned + alignment + unused;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &s, const heap_stats &stats) {
+  s << "registered " << stats.registered_bytes() << " bytes in "
+    << stats.regions() << " region(s), " << stats.wasted()
+    << " bytes not in use (free " << stats.free_bytes << ", abandoned "
+    << stats.abandoned << ", alignment " << stats.alignment << ", unused "
+    << stats.unused << ")";
+  if (stats.allocated)
+    s << ", " << stats.requested << " bytes requested in "
+      << stats.allocated << " bytes allocated";
+  for (auto &&c : stats.classes) {
+    if (c.blocks)
+      s << std::endl << "  class " << c.size << ": " << c.blocks
+        << " blocks, " << c.free_blocks << " free";
+  }
+  return s;
+}
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+
+#include "util/concurrent.h"
+#include "allocators/HeapStats.h"
+
+namespace hydra {
+
+/* Drop-in alternative to FreeListHeap: freed blocks are kept on a Treiber
+ * stack threaded through the blocks themselves, so neither malloc nor free
+ * takes a lock unless the stack is empty and SuperHeap has to be asked.
+ *
+ * The head packs a 48 bit pointer with a 16 bit tag, which is incremented by
+ * every push and pop, to detect ABA. This relies on x86-64 canonical
+ * addresses. Blocks are never returned to SuperHeap, so reading the link of a
+ * block which was popped concurrently is harmless; the CAS fails.
+ */
+template <class SuperHeap> class LockFreeFreeListHeap : public SuperHeap {
+public:
+  template <typename T>
+  using pointer_t = typename SuperHeap::template pointer_t<T>;
+  template <typename T>
+  using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
+
+private:
+  struct node {
+    std::atomic<node *> next;
+    ibv_mr *mr;
+  };
+
+  static constexpr unsigned PointerBits = 48;
+  static constexpr uint64_t PointerMask = (uint64_t(1) << PointerBits) - 1;
+
+  static node *pointer_of(const uint64_t head) {
+    return reinterpret_cast<node *>(head & PointerMask);
+  }
+  static uint64_t pack(const node *n, const uint64_t old) {
+    const uint64_t tag = (old >> PointerBits) + 1;
+    return (tag << PointerBits) | reinterpret_cast<uint64_t>(n);
+  }
+
+  std::atomic<uint64_t> head;
+  /* next to head, whose cache line push and pop own anyway; counted up before
+   * a block is pushed, so that it never drops below the length of the stack
+   */
+  std::atomic<size_t> free_count;
+  std::vector<rdma_ptr<char> > allocs;
+  size_t block_size = 0;
+  spinlock allocs_lock;
+  std::atomic<size_t> *free_hint = nullptr;
+  size_t free_hint_mask = 0;
+
+  node *pop() {
+    uint64_t old = head.load(std::memory_order_acquire);
+    for (;;) {
+      node *n = pointer_of(old);
+      if (n == nullptr)
+        return nullptr;
+      node *next = n->next.load(std::memory_order_relaxed);
+      if (head.compare_exchange_weak(old, pack(next, old),
+                                     std::memory_order_acquire,
+                                     std::memory_order_acquire)) {
+        free_count.fetch_sub(1, std::memory_order_relaxed);
+        if (next == nullptr && free_hint)
+          free_hint->fetch_and(~free_hint_mask, std::memory_order_relaxed);
+        return n;
+      }
+    }
+  }
+
+  void push(char *p, ibv_mr *mr) {
+    node *n = reinterpret_cast<node *>(p);
+    n->mr = mr;
+    free_count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t old = head.load(std::memory_order_relaxed);
+    do {
+      n->next.store(pointer_of(old), std::memory_order_relaxed);
+    } while (!head.compare_exchange_weak(old, pack(n, old),
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed));
+    if (pointer_of(old) == nullptr && free_hint)
+      free_hint->fetch_or(free_hint_mask, std::memory_order_release);
+  }
+
+  template <typename T> rdma_ptr<T> make_pointer(char *p, ibv_mr *mr) {
+    return rdma_ptr<T>(pointer_t<T>(reinterpret_cast<T *>(p),
+                                    [this, mr](T *p) {
+                                      push(reinterpret_cast<char *>(p), mr);
+                                    }),
+                       mr);
+  }
+
+public:
+  template <typename... Args, typename = std::enable_if<!std::is_same<
+                                  LockFreeFreeListHeap, Args...>::value> >
+  LockFreeFreeListHeap(Args &&... args)
+      : SuperHeap(std::forward<Args>(args)...), head(0), free_count(0) {
+    assert(head.is_lock_free());
+  }
+
+  LockFreeFreeListHeap(LockFreeFreeListHeap &&other)
+      : SuperHeap(std::move(other)), head(other.head.load()),
+        free_count(other.free_count.load()), allocs(std::move(other.allocs)),
+        block_size(other.block_size), free_hint(other.free_hint),
+        free_hint_mask(other.free_hint_mask) {
+    other.head = 0;
+    other.free_count = 0;
+  }
+
+  template <typename T> inline rdma_ptr<T> malloc(const size_t n_elems = 1) {
+    if (node *n = pop())
+      return make_pointer<T>(reinterpret_cast<char *>(n), n->mr);
+
+    /* freed blocks have to hold a node */
+    const size_t size = std::max(n_elems * sizeof(T), sizeof(node));
+    std::unique_lock<spinlock> l(allocs_lock);
+    allocs.push_back(SuperHeap::template malloc<char>(size));
+    block_size = std::max(block_size, size);
+    return make_pointer<T>(allocs.back().first.get(), allocs.back().second);
+  }
+
+  /* Reuses a freed block, but does not ask SuperHeap for memory. */
+  template <typename T> inline rdma_ptr<T> try_malloc() {
+    if (node *n = pop())
+      return make_pointer<T>(reinterpret_cast<char *>(n), n->mr);
+    return rdma_ptr<T>(pointer_t<T>(nullptr), nullptr);
+  }
+
+  /* Keeps mask set in *hint while there are free blocks. A push and a pop
+   * racing on an almost empty stack may leave it clear although a block is
+   * free.
+   */
+  void set_free_hint(std::atomic<size_t> *hint, const size_t mask) {
+    free_hint = hint;
+    free_hint_mask = mask;
+  }
+
+  /* Free bytes assume all blocks are as large as the largest one. */
+  void stats(hydra::heap_stats &s) {
+    const size_t free = free_count.load(std::memory_order_relaxed);
+    std::unique_lock<spinlock> l(allocs_lock);
+    s.blocks += allocs.size();
+    s.free_blocks += free;
+    s.free_bytes += free * block_size;
+    l.unlock();
+    SuperHeap::stats(s);
+  }
+};
+}
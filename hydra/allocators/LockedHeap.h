@@ -3,6 +3,7 @@
 #include <mutex>
 
 #include "util/concurrent.h"
+#include "allocators/HeapStats.h"
 
 namespace hydra {
 template <typename SuperHeap> class LockedHeap {
@@ -21,5 +22,9 @@ public:
     std::unique_lock<spinlock> l(lock);
     return superheap.template malloc<T>(n_elems);
   }
+  void stats(hydra::heap_stats &s) {
+    std::unique_lock<spinlock> l(lock);
+    superheap.stats(s);
+  }
 };
 }
@@ -6,6 +6,7 @@
 
 #include "util/Logger.h"
 #include "hydra/hash.h"
+#include "allocators/HeapStats.h"
 
 #ifndef LEVEL1_DCACHE_LINESIZE
 #error Set -DLEVEL1_DCACHE_LINESIZE=... as preprocessor define
@@ -67,5 +68,11 @@ public:
 #endif
     return heaps[index].template malloc<T>(n_elems);
   }
+
+  /* heaps which share a socket share its registered memory */
+  void stats(hydra::heap_stats &s) {
+    for (size_t i = 0; i < numHeaps; i++)
+      heaps[i].stats(s);
+  }
 };
 }
@@ -61,6 +61,7 @@
 
 #include <assert.h>
 #include "util/utils.h"
+#include "allocators/HeapStats.h"
 
 namespace hydra {
 
@@ -100,6 +101,8 @@ class SegregatedFitsHeap : public SuperHeap {
   std::vector<size_t> binmap;
   std::function<size_t(size_t)> size2Class;
   size_t maxSize;
+  /* largest size of each class */
+  std::vector<size_t> classSize;
   std::vector<BinHeap> binHeap;
 
 public:
@@ -115,8 +118,9 @@ public:
         /* rounded up division of numBins / bits per size_t */
         entries((numBins + std::numeric_limits<size_t>::digits - 1) /
                 std::numeric_limits<size_t>::digits),
-        binmap(entries, 0), size2Class(size2Class) {
+        binmap(entries, 0), size2Class(size2Class), classSize(numBins, 0) {
     for (size_t i = 0, lastSize = 0; size2Class(i) < numBins; i++) {
+      classSize[size2Class(i)] = i;
       static_cast<void>(lastSize);
 #ifndef NDEBUG
       if(size2Class(i) != size2Class(i + 1)) {
@@ -196,6 +200,17 @@ public:
     return ptr;
 #endif
   }
+
+  /* one class per bin, followed by those of SuperHeap */
+  void stats(hydra::heap_stats &s) {
+    for (size_t i = 0; i < binHeap.size(); i++) {
+      hydra::heap_stats bin;
+      binHeap[i].stats(bin);
+      s.classes.push_back({ classSize[i], bin.blocks, bin.free_blocks });
+      s += bin;
+    }
+    SuperHeap::stats(s);
+  }
 #if 0
   inline void free(void *ptr) {
     // printf ("Free: %x (%d bytes)\n", ptr, getSize(ptr));
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+
+#include "allocators/HeapStats.h"
+
+namespace hydra {
+
+/* largest size whose class is below SizeClass::bins */
+template <typename SizeClass> constexpr size_t largest_class_size() {
+  size_t size = 0;
+  while (SizeClass::size_class(size + 1) < SizeClass::bins)
+    size++;
+  return size;
+}
+
+/* Size class lookup for StaticSegregatedFitsHeap, computed at compile time.
+ * SizeClass provides
+ *   static constexpr size_t bins;
+ *   static constexpr size_t size_class(size_t size);
+ * Sizes are looked up in steps of granularity, so all class boundaries have to
+ * be multiples of it.
+ */
+template <typename SizeClass, size_t granularity> struct size_class_table {
+  static constexpr size_t bins = SizeClass::bins;
+  static_assert(bins <= std::numeric_limits<uint8_t>::max() + 1,
+                "Too many size classes for the lookup table");
+
+  static constexpr size_t max_size = largest_class_size<SizeClass>();
+  static constexpr size_t entries = max_size / granularity + 1;
+
+  /* class of the sizes ((i - 1) * granularity, i * granularity] */
+  uint8_t size_class[entries];
+  /* largest size of each class */
+  size_t class_size[bins];
+  bool aligned;
+
+  constexpr size_class_table() : size_class(), class_size(), aligned(true) {
+    for (size_t i = 0; i < entries; i++)
+      size_class[i] =
+          static_cast<uint8_t>(SizeClass::size_class(i * granularity));
+    for (size_t size = 0; size <= max_size; size++) {
+      const size_t sc = SizeClass::size_class(size);
+      class_size[sc] = size;
+      const size_t rounded = (size + granularity - 1) / granularity;
+      if (size_class[rounded] != sc)
+        aligned = false;
+    }
+  }
+};
+
+/* SegregatedFitsHeap with the size classes fixed at compile time: the class of
+ * a size is a table lookup instead of a call through std::function.
+ *
+ * Requests are rounded up to the largest size of their class, so every block
+ * of a bin can serve every request of that class. If the bin of a request has
+ * no free block, the next larger bin which has one is used before the bin
+ * grows. The binmap marks the bins which have free blocks; the bins keep their
+ * bit up to date. BinHeap has to provide try_malloc(), which only reuses freed
+ * blocks, and set_free_hint().
+ *
+ * Like SegregatedFitsHeap, malloc is not thread-safe; blocks may be freed
+ * concurrently. With LockFreeFreeListHeap bins and a thread-safe SuperHeap,
+ * malloc is thread-safe as well. A bin whose bit is cleared while another
+ * thread frees into it still serves its own class; only requests of smaller
+ * classes no longer fall back to it.
+ */
+template <typename SizeClass, class BinHeap, class SuperHeap,
+          size_t granularity = 8>
+class StaticSegregatedFitsHeap : public SuperHeap {
+  using table_t = size_class_table<SizeClass, granularity>;
+  static constexpr table_t table{};
+  static_assert(table.aligned,
+                "Size class boundaries must be multiples of granularity");
+
+  static constexpr size_t bins = table_t::bins;
+  static constexpr size_t bits = std::numeric_limits<size_t>::digits;
+  static constexpr size_t entries = (bins + bits - 1) / bits;
+
+  /* maintained by the bins, see set_free_hint() */
+  std::atomic<size_t> binmap[entries];
+  std::vector<BinHeap> binHeap;
+
+  void unmark(const size_t sc) {
+    binmap[sc / bits].fetch_and(~(size_t(1) << (sc % bits)),
+                                std::memory_order_relaxed);
+  }
+
+  /* first marked bin at or above sc, bins if there is none */
+  size_t next_marked(const size_t sc) const {
+    if (sc >= bins)
+      return bins;
+    size_t entry = sc / bits;
+    size_t map = binmap[entry].load(std::memory_order_acquire) &
+                 (~size_t(0) << (sc % bits));
+    while (map == 0) {
+      if (++entry == entries)
+        return bins;
+      map = binmap[entry].load(std::memory_order_acquire);
+    }
+    return entry * bits + static_cast<size_t>(__builtin_ctzl(map));
+  }
+
+public:
+  template <typename T>
+  using pointer_t = typename SuperHeap::template pointer_t<T>;
+  template <typename T>
+  using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
+
+  static constexpr size_t max_size = table_t::max_size;
+
+  template <typename... Args>
+  StaticSegregatedFitsHeap(Args &&... args)
+      : SuperHeap(std::forward<Args>(args)...) {
+    for (auto &&map : binmap)
+      map.store(0, std::memory_order_relaxed);
+    /* bins hand out pointers to themselves, they must not move */
+    binHeap.reserve(bins);
+    for (size_t i = 0; i < bins; i++) {
+      binHeap.emplace_back(std::forward<Args>(args)...);
+      binHeap.back().set_free_hint(&binmap[i / bits],
+                                   size_t(1) << (i % bits));
+    }
+  }
+
+  StaticSegregatedFitsHeap(const StaticSegregatedFitsHeap &) = delete;
+  StaticSegregatedFitsHeap(StaticSegregatedFitsHeap &&) = delete;
+
+  static constexpr size_t size_class(const size_t size) {
+    return table.size_class[(size + granularity - 1) / granularity];
+  }
+
+  template <typename T> inline rdma_ptr<T> malloc(const size_t n_elems = 1) {
+    const size_t size = n_elems * sizeof(T);
+    if (size > max_size)
+      return SuperHeap::template malloc<T>(n_elems);
+
+    const size_t sc = size_class(size);
+    for (size_t bin = next_marked(sc); bin < bins; bin = next_marked(bin + 1)) {
+      auto p = binHeap[bin].template try_malloc<T>();
+      if (p.first)
+        return p;
+      unmark(bin);
+    }
+
+    const size_t n = (table.class_size[sc] + sizeof(T) - 1) / sizeof(T);
+    return binHeap[sc].template malloc<T>(std::max<size_t>(n, 1));
+  }
+
+  /* one class per bin, followed by those of SuperHeap */
+  void stats(hydra::heap_stats &s) {
+    for (size_t i = 0; i < bins; i++) {
+      hydra::heap_stats bin;
+      binHeap[i].stats(bin);
+      s.classes.push_back({ table.class_size[i], bin.blocks, bin.free_blocks });
+      s += bin;
+    }
+    SuperHeap::stats(s);
+  }
+};
+
+template <typename SizeClass, class BinHeap, class SuperHeap,
+          size_t granularity>
+constexpr typename StaticSegregatedFitsHeap<SizeClass, BinHeap, SuperHeap,
+                                            granularity>::table_t
+    StaticSegregatedFitsHeap<SizeClass, BinHeap, SuperHeap,
+                             granularity>::table;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+
+#include "util/concurrent.h"
+#include "util/utils.h"
+#include "allocators/HeapStats.h"
+#include "allocators/StaticSegregatedFitsHeap.h"
+
+#ifndef LEVEL1_DCACHE_LINESIZE
+#error Set -DLEVEL1_DCACHE_LINESIZE=... as preprocessor define
+#endif
+
+namespace hydra {
+
+/* Thread-local caching front-end for a size-class heap, in the spirit of
+ * tcmalloc: every thread keeps free lists per size class and only takes a lock
+ * to move a batch of blocks from or to the central free lists. Blocks are
+ * returned to the cache of the thread which frees them. Caches of threads which
+ * exit are flushed to the central lists.
+ *
+ * The size classes are a compile-time policy as for StaticSegregatedFitsHeap,
+ * so finding the class of a request is a table lookup. Blocks are carved from
+ * one SuperHeap allocation per batch, which is only made under a lock, and are
+ * never given back to it. Requests beyond the largest size class go to
+ * SuperHeap directly.
+ *
+ * The constructor arguments are passed on to SuperHeap.
+ */
+template <typename SizeClass, typename SuperHeap, size_t granularity = 8>
+class ThreadCacheHeap : public SuperHeap {
+public:
+  template <typename T>
+  using pointer_t = typename SuperHeap::template pointer_t<T>;
+  template <typename T>
+  using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
+
+private:
+  using table_t = size_class_table<SizeClass, granularity>;
+  static constexpr table_t table{};
+  static_assert(table.aligned,
+                "Size class boundaries must be multiples of granularity");
+  static constexpr size_t bins = table_t::bins;
+
+  /* about 64 KiB per batch, between 4 and 64 blocks */
+  static constexpr size_t batch_size(const size_t sc) {
+    return std::max<size_t>(
+        4, std::min<size_t>(64, (64 * 1024) / (table.class_size[sc] + 1)));
+  }
+
+  /* The memory regions of all blocks are kept in a table, so that a deleter
+   * only captures the heap and a packed (memory region, size class) pair and
+   * fits into std::function without allocating.
+   */
+  enum { MaxRegions = 4096, ClassBits = 8 };
+  using block_t = std::pair<char *, uint32_t>;
+
+  struct thread_cache {
+    std::vector<std::vector<block_t> > lists;
+    thread_cache(const size_t classes) : lists(classes) {}
+  };
+
+  struct alignas(LEVEL1_DCACHE_LINESIZE) central_list {
+    spinlock lock;
+    std::vector<block_t> blocks;
+  };
+
+  /* caches of the calling thread, one per heap it used */
+  struct thread_state {
+    struct entry {
+      uint64_t id;
+      ThreadCacheHeap *heap;
+      thread_cache *cache;
+    };
+    std::vector<entry> caches;
+    entry last = { 0, nullptr, nullptr };
+
+    ~thread_state() {
+      auto &r = registry();
+      std::unique_lock<std::mutex> l(r.mutex);
+      for (auto &&e : caches) {
+        /* the heap might be gone, or another one live at its address */
+        auto it = r.heaps.find(e.id);
+        if (it != r.heaps.end())
+          it->second->orphan(e.cache);
+      }
+    }
+  };
+
+  struct heap_registry {
+    std::mutex mutex;
+    std::unordered_map<uint64_t, ThreadCacheHeap *> heaps;
+    uint64_t next_id = 1;
+  };
+
+  static heap_registry &registry() {
+    static heap_registry r;
+    return r;
+  }
+
+  static thread_state &local() {
+    static thread_local thread_state state;
+    return state;
+  }
+
+  std::vector<central_list, util::aligned_allocator<central_list> > central;
+  uint64_t id;
+
+  spinlock super_lock;
+  std::vector<rdma_ptr<char> > allocs;
+  /* written under super_lock before a block referring to them is handed out */
+  ibv_mr *regions[MaxRegions];
+  uint32_t n_regions = 0;
+
+  /* caller holds super_lock */
+  uint32_t region_index(ibv_mr *mr) {
+    for (uint32_t i = n_regions; i > 0; i--) {
+      if (regions[i - 1] == mr)
+        return i - 1;
+    }
+    if (n_regions == MaxRegions)
+      throw std::bad_alloc();
+    regions[n_regions] = mr;
+    return n_regions++;
+  }
+
+  std::mutex caches_lock;
+  std::vector<std::unique_ptr<thread_cache> > caches;
+  std::vector<thread_cache *> idle_caches;
+
+  thread_cache &cache() {
+    auto &state = local();
+    if (state.last.heap == this && state.last.id == id)
+      return *state.last.cache;
+
+    auto it = std::find_if(
+        state.caches.begin(), state.caches.end(),
+        [this](auto &&e) { return e.heap == this && e.id == id; });
+    if (it == state.caches.end()) {
+      state.caches.push_back({ id, this, adopt() });
+      it = state.caches.end() - 1;
+    }
+    state.last = *it;
+    return *it->cache;
+  }
+
+  thread_cache *adopt() {
+    std::unique_lock<std::mutex> l(caches_lock);
+    if (!idle_caches.empty()) {
+      auto c = idle_caches.back();
+      idle_caches.pop_back();
+      return c;
+    }
+    caches.push_back(std::make_unique<thread_cache>(bins));
+    return caches.back().get();
+  }
+
+  /* called with the registry locked, by a thread which exits */
+  void orphan(thread_cache *c) {
+    for (size_t sc = 0; sc < c->lists.size(); sc++) {
+      auto &list = c->lists[sc];
+      std::unique_lock<spinlock> l(central[sc].lock);
+      central[sc].blocks.insert(central[sc].blocks.end(), list.begin(),
+                                list.end());
+      list.clear();
+    }
+    std::unique_lock<std::mutex> l(caches_lock);
+    idle_caches.push_back(c);
+  }
+
+  void refill(std::vector<block_t> &list, const size_t sc) {
+    const size_t batch = batch_size(sc);
+    {
+      auto &c = central[sc];
+      std::unique_lock<spinlock> l(c.lock);
+      const size_t n = std::min(batch, c.blocks.size());
+      list.insert(list.end(), c.blocks.end() - n, c.blocks.end());
+      c.blocks.resize(c.blocks.size() - n);
+    }
+    if (!list.empty())
+      return;
+
+    const size_t size = table.class_size[sc];
+    std::unique_lock<spinlock> l(super_lock);
+    allocs.push_back(SuperHeap::template malloc<char>(batch * size));
+    char *p = allocs.back().first.get();
+    const uint32_t region = region_index(allocs.back().second);
+    for (size_t i = 0; i < batch; i++)
+      list.emplace_back(p + i * size, region);
+  }
+
+  void release(char *p, const uint32_t packed) {
+    const size_t sc = packed & ((1U << ClassBits) - 1);
+    auto &list = cache().lists[sc];
+    list.emplace_back(p, packed >> ClassBits);
+    const size_t batch = batch_size(sc);
+    if (list.size() < 2 * batch)
+      return;
+
+    /* hand the older half to the central list */
+    auto &c = central[sc];
+    std::unique_lock<spinlock> l(c.lock);
+    c.blocks.insert(c.blocks.end(), list.begin(), list.begin() + batch);
+    list.erase(list.begin(), list.begin() + batch);
+  }
+
+public:
+  template <typename... Args>
+  ThreadCacheHeap(Args &&... args)
+      : SuperHeap(std::forward<Args>(args)...), central(bins) {
+    static_assert(bins <= (1U << ClassBits), "Too many size classes");
+    auto &r = registry();
+    std::unique_lock<std::mutex> l(r.mutex);
+    id = r.next_id++;
+    r.heaps.emplace(id, this);
+  }
+
+  ThreadCacheHeap(const ThreadCacheHeap &) = delete;
+  ThreadCacheHeap(ThreadCacheHeap &&) = delete;
+
+  ~ThreadCacheHeap() {
+    auto &r = registry();
+    std::unique_lock<std::mutex> l(r.mutex);
+    r.heaps.erase(id);
+  }
+
+  template <typename T> inline rdma_ptr<T> malloc(const size_t n_elems = 1) {
+    const size_t size = std::max<size_t>(n_elems * sizeof(T), 1);
+    if (size > table_t::max_size) {
+      std::unique_lock<spinlock> l(super_lock);
+      return SuperHeap::template malloc<T>(n_elems);
+    }
+    const size_t sc = table.size_class[(size + granularity - 1) / granularity];
+
+    auto &list = cache().lists[sc];
+    if (list.empty())
+      refill(list, sc);
+    const block_t block = list.back();
+    list.pop_back();
+
+    const uint32_t packed =
+        (block.second << ClassBits) | static_cast<uint32_t>(sc);
+    return rdma_ptr<T>(pointer_t<T>(reinterpret_cast<T *>(block.first),
+                                    [this, packed](T *p) {
+                                      release(reinterpret_cast<char *>(p),
+                                              packed);
+                                    }),
+                       regions[block.second]);
+  }
+
+  /* Blocks in the caches of threads cannot be counted without stopping them
+   * and are reported as in use; those on the central lists are free. Blocks
+   * of SuperHeap are all in use from its point of view.
+   */
+  void stats(hydra::heap_stats &s) {
+    for (size_t sc = 0; sc < bins; sc++) {
+      std::unique_lock<spinlock> l(central[sc].lock);
+      const size_t free = central[sc].blocks.size();
+      s.free_blocks += free;
+      s.free_bytes += free * table.class_size[sc];
+    }
+    std::unique_lock<spinlock> l(super_lock);
+    SuperHeap::stats(s);
+  }
+};
+
+template <typename SizeClass, typename SuperHeap, size_t granularity>
+constexpr typename ThreadCacheHeap<SizeClass, SuperHeap, granularity>::table_t
+    ThreadCacheHeap<SizeClass, SuperHeap, granularity>::table;
+template <typename SizeClass, typename SuperHeap, size_t granularity>
+constexpr size_t ThreadCacheHeap<SizeClass, SuperHeap, granularity>::bins;
+}
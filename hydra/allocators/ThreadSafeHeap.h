@@ -2,6 +2,7 @@
 #include <utility>
 #include <cstddef>
 #include "util/concurrent.h"
+#include "allocators/HeapStats.h"
 
 namespace hydra {
 template <typename SuperHeap> class ThreadSafeHeap {
@@ -21,5 +22,9 @@ public:
       return s.template malloc<T>(n_elems);
     });
   }
+
+  void stats(hydra::heap_stats &stats) {
+    superHeap([&stats](SuperHeap &s) { s.stats(stats); });
+  }
 };
 }
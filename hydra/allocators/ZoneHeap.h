@@ -1,11 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <utility>
 #include <cstddef>
 #include <vector>
 #include <algorithm>
 
 #include "allocators/config.h"
+#include "allocators/HeapStats.h"
 
 namespace hydra {
 template <typename SuperHeap, size_t chunkSize>
@@ -17,12 +19,21 @@ public:
   using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
   template <typename... Args>
   ZoneHeap(Args &&... args)
-      : SuperHeap(std::forward<Args>(args)...), remaining(0), current(0) {
+      : SuperHeap(std::forward<Args>(args)...), remaining(0), current(0),
+        stranded(0), padding(0), abandoned(0) {
     static_assert(chunkSize >= hydra::AllocatorConfig::Alignment,
                   "chunkSize needs to be at least as large as the alignment "
                   "requirement.");
   }
 
+  ZoneHeap(ZoneHeap &&other)
+      : SuperHeap(std::move(other)), arenas(std::move(other.arenas)),
+        remaining(other.remaining), current(other.current),
+        stranded(other.stranded), padding(other.padding),
+        abandoned(other.abandoned.load()) {
+    other.remaining = 0;
+  }
+
   template <typename T> inline rdma_ptr<T> malloc(const size_t n_elems = 1) {
     size_t size =
         hydra::align<hydra::AllocatorConfig::Alignment>(n_elems * sizeof(T));
@@ -30,23 +41,39 @@ public:
       expand(std::max(size, chunkSize));
 
     remaining -= size;
+    padding += size - n_elems * sizeof(T);
     rdma_ptr<T> ret(
         pointer_t<T>(reinterpret_cast<T *>(arenas.back().first.get() + current),
-                     [](T *) { /*log_debug() << "Deallocating " << p;*/ }),
+                     [this, size](T *) {
+                       /* memory is only reclaimed with the heap */
+                       abandoned.fetch_add(size, std::memory_order_relaxed);
+                     }),
         arenas.back().second);
     current += size;
 
     return ret;
   }
 
+  void stats(hydra::heap_stats &s) {
+    s.abandoned += abandoned.load(std::memory_order_relaxed);
+    s.alignment += padding;
+    s.unused += stranded + remaining;
+    SuperHeap::stats(s);
+  }
+
 private:
   void expand(size_t size = chunkSize) {
     arenas.push_back(SuperHeap::template malloc<char>(size));
+    stranded += remaining;
     remaining = size;
     current = 0;
   }
   std::vector<rdma_ptr<char> > arenas;
   size_t remaining;
   size_t current;
+  /* left at the end of previous chunks */
+  size_t stranded;
+  size_t padding;
+  std::atomic<size_t> abandoned;
 };
 }
@@ -3,19 +3,18 @@
 #include "RDMAAllocator.h"
 
 #include "allocators/PerThreadAllocator.h"
+#include "allocators/ThreadCacheHeap.h"
 #include "allocators/ZoneHeap.h"
 #include "allocators/ThreadSafeHeap.h"
 #include "allocators/FreeListHeap.h"
+#include "allocators/LockFreeFreeListHeap.h"
 #include "allocators/SegregatedFitsHeap.h"
+#include "allocators/StaticSegregatedFitsHeap.h"
+#include "allocators/BuddyHeap.h"
 
 #include "util/utils.h"
 
-using default_heap_t = hydra::ThreadSafeHeap<hydra::SegregatedFitsHeap<
-    hydra::FreeListHeap<
-        hydra::ZoneHeap<RdmaHeap<ibv_access::READ>, 1024 * 1024 * 16> >,
-    hydra::ZoneHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024> > >;
-
-static inline size_t default_size_classes(size_t size) {
+static constexpr size_t default_size_classes(size_t size) {
   if (size == 0)
     return 0;
   if (size <= 128) // 16 bins
@@ -23,6 +22,32 @@ static inline size_t default_size_classes(size_t size) {
   else if (size <= 4096) // 31 bins
     return ((size + (128 - 1)) & ~(128 - 1)) / 128 + 14;
   else
-    return 47 + hydra::util::log2(size - 1) -
+    return 47 + hydra::util::log2_(size - 1) -
            hydra::util::static_log2<4096>::value;
 }
+
+/* Size class policy of default_size_classes for StaticSegregatedFitsHeap */
+struct default_size_class {
+  static constexpr size_t bins = 48;
+  static constexpr size_t size_class(const size_t size) {
+    return default_size_classes(size);
+  }
+};
+
+/* Server-side key/value storage: freed values are reused after a grace period.
+ * BuddyHeap locks internally. With several workers, THREAD_CACHE_HEAP puts
+ * per-thread caches in front of it, so that allocations of different workers
+ * do not contend for its lock (cmake -DTHREAD_CACHE_HEAP=ON).
+ */
+#ifndef THREAD_CACHE_HEAP
+#define THREAD_CACHE_HEAP 0
+#endif
+
+#if THREAD_CACHE_HEAP
+using default_heap_t = hydra::ThreadCacheHeap<
+    default_size_class,
+    hydra::BuddyHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024> >;
+#else
+using default_heap_t =
+    hydra::BuddyHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024>;
+#endif
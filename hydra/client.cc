@@ -42,3 +42,61 @@ hydra::client::get(const std::vector<unsigned char> &key) const {
   return dht.get(key);
 }
 
+/* Indices 0..n-1 grouped by the node responsible for key(i). */
+template <typename Key>
+std::unordered_map<hydra::passive *, std::vector<size_t> >
+hydra::client::partition(const size_t n, Key &&key) const {
+  std::unordered_map<passive *, std::vector<size_t> > nodes;
+  for (size_t i = 0; i < n; i++)
+    nodes[&responsible_node(key(i))].push_back(i);
+  return nodes;
+}
+
+std::vector<std::vector<unsigned char> > hydra::client::multi_get(
+    const std::vector<std::vector<unsigned char> > &keys) const {
+  std::vector<std::vector<unsigned char> > values(keys.size());
+  auto key = [&](size_t i) -> const std::vector<unsigned char> & {
+    return keys[i];
+  };
+  auto nodes = partition(keys.size(), key);
+
+  for (const auto &node : nodes) {
+    std::vector<std::vector<unsigned char> > batch;
+    batch.reserve(node.second.size());
+    for (const auto i : node.second)
+      batch.push_back(keys[i]);
+
+    auto result = node.first->multi_get(batch);
+    for (size_t i = 0; i < result.size(); i++)
+      values[node.second[i]] = std::move(result[i]);
+  }
+
+  return values;
+}
+
+std::vector<bool> hydra::client::multi_put(
+    const std::vector<std::pair<std::vector<unsigned char>,
+                                std::vector<unsigned char> > > &kvs) const {
+  std::vector<bool> results(kvs.size());
+  auto key = [&](size_t i) -> const std::vector<unsigned char> & {
+    return kvs[i].first;
+  };
+  auto nodes = partition(kvs.size(), key);
+
+  for (const auto &node : nodes) {
+    std::vector<std::pair<std::vector<unsigned char>, size_t> > batch;
+    batch.reserve(node.second.size());
+    for (const auto i : node.second) {
+      std::vector<unsigned char> kv(kvs[i].first);
+      kv.insert(std::end(kv), std::begin(kvs[i].second),
+                std::end(kvs[i].second));
+      batch.emplace_back(std::move(kv), kvs[i].first.size());
+    }
+
+    auto result = node.first->multi_put(batch);
+    for (size_t i = 0; i < result.size(); i++)
+      results[node.second[i]] = result[i];
+  }
+
+  return results;
+}
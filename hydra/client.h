@@ -2,6 +2,8 @@
 
 #include <memory>
 #include <vector>
+#include <utility>
+#include <unordered_map>
 
 #include "hydra/network.h"
 #include "hydra/passive.h"
@@ -16,9 +18,20 @@ public:
   bool contains(const std::vector<unsigned char> &key) const;
   std::vector<unsigned char> get(const std::vector<unsigned char> &key) const;
 
+  /* Keys are grouped by responsible node and sent as one batch per node. */
+  std::vector<std::vector<unsigned char> >
+  multi_get(const std::vector<std::vector<unsigned char> > &keys) const;
+  std::vector<bool>
+  multi_put(const std::vector<std::pair<std::vector<unsigned char>,
+                                        std::vector<unsigned char> > > &kvs)
+      const;
+
 private:
   std::unique_ptr<hydra::overlay::network> network;
   passive &responsible_node(const std::vector<unsigned char> &key) const;
+  template <typename Key>
+  std::unordered_map<passive *, std::vector<size_t> >
+  partition(const size_t n, Key &&key) const;
 };
 }
 
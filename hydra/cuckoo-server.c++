@@ -19,7 +19,7 @@ size_t hydra::cuckoo_server::index(const key_type &key,
   /* from 'const unsigned char *' to 'const char *' */
   auto ptr = reinterpret_cast<const char *>(key.first);
   const auto size = key.second;
-  return CityHash64WithSeed(ptr, size, seed) % table_size;
+  return reduce(CityHash64WithSeed(ptr, size, seed), table_size);
 }
 
 void hydra::cuckoo_server::rehash() {
@@ -93,8 +93,9 @@ hydra::Return_t hydra::cuckoo_server::remove(const key_type &key) {
   return SUCCESS;
 }
 
-void hydra::cuckoo_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
-                                  size_t size) {
+hydra::Return_t
+hydra::cuckoo_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
+                             size_t size) {
   log_info() << "Table size: " << size;
   table_size = size;
   table = new_table;
@@ -110,6 +111,7 @@ void hydra::cuckoo_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
   std::swap(shadow_table, tmp_shadow_table);
   used_ = 0;
 
+  Return_t result = SUCCESS;
   for (auto &&entry : tmp_shadow_table) {
     if (entry) {
       auto tmp = std::make_tuple(std::move(entry.mem), entry.size(),
@@ -117,11 +119,13 @@ void hydra::cuckoo_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
       auto ret = add(tmp);
       if (ret != SUCCESS) {
         std::cerr << "Error during resizing." << std::endl;
+        result = ret;
       }
     }
   }
 
   log_size = hydra::util::log2(table_size);
+  return result;
 }
 
 size_t hydra::cuckoo_server::contains(const key_type &key) {
@@ -133,6 +137,15 @@ size_t hydra::cuckoo_server::contains(const key_type &key) {
   return invalid_index();
 }
 
+bool hydra::cuckoo_server::relocate(const key_type &key, mem_type &to,
+                                    const uint32_t rkey) {
+  const size_t idx = contains(key);
+  if (!index_valid(idx) || shadow_table[idx].key() != key.first)
+    return false;
+  reclaimer.retire(shadow_table[idx].relocate(std::move(to), rkey));
+  return true;
+}
+
 void hydra::cuckoo_server::dump() const { dump(0, table_size); }
 void hydra::cuckoo_server::dump(const size_t &from, const size_t &to) const {
   for (size_t i = from; i < to; i++) {
@@ -151,7 +164,7 @@ void hydra::cuckoo_server::check_consistency() const {
     if ((shadow_entry.mem.get() != rdma_entry.get().key()) ||
         (shadow_entry.rkey() != rdma_entry.get().rkey) ||
         (shadow_entry.size() != rdma_entry.get().ptr.size) ||
-        (shadow_entry.key_size() != rdma_entry.get().key_size) ||
+        (shadow_entry.key_size() != rdma_entry.get().key_length()) ||
         (!rdma_entry.valid())) {
       std::cout << i << " " << shadow_entry << std::endl;
       std::cout << std::boolalpha << "valid: " << rdma_entry.valid()
@@ -38,12 +38,13 @@ class cuckoo_server : public server_dht {
 
       entry([&](auto &&e) {
         using std::swap;
-        /* swap(e.ptr.size, std::get<1>(entry_)); */
-        size_t size = e.ptr.size;
-        e.ptr = verifying_ptr<unsigned char>(mem.get(), std::get<1>(entry_));
+        const size_t size = e.ptr.size;
+        const size_t key_size = e.key_length();
+        e.point_to(mem.get(), std::get<1>(entry_), std::get<2>(entry_));
         std::get<1>(entry_) = size;
-
-        swap(e.key_size, std::get<2>(entry_));
+        std::get<2>(entry_) = key_size;
+        e.fingerprint =
+            hash_table_entry::fingerprint_of(mem.get(), e.key_length());
         swap(e.rkey, std::get<3>(entry_));
         swap(e.hop, seed_idx);
       });
@@ -54,13 +55,24 @@ class cuckoo_server : public server_dht {
       entry([hash = static_cast<uint32_t>(hash)](auto && e) { e.hop = hash; });
     }
     size_t size() const noexcept { return entry.get().ptr.size; }
-    size_t key_size() const noexcept { return entry.get().key_size; }
+    size_t key_size() const noexcept { return entry.get().key_length(); }
     uint32_t rkey() const noexcept { return entry.get().rkey; }
     bool has_key(const key_type &other_key) const noexcept {
       return std::equal(key(), key() + key_size(), other_key.first,
                         other_key.first + other_key.second);
     }
 
+    /* Returns the previous copy of the same key/value. */
+    mem_type relocate(mem_type ptr, uint32_t rkey) {
+      mem_type old = std::move(mem);
+      mem = std::move(ptr);
+      entry([&](auto &&entry) {
+        entry.point_to(mem.get(), entry.ptr.size, entry.key_length());
+        entry.rkey = rkey;
+      });
+      return old;
+    }
+
     void empty() {
       entry([](auto &&entry) { entry.empty(); });
       mem.reset();
@@ -100,8 +112,10 @@ public:
   cuckoo_server(cuckoo_server &&) = default;
   Return_t add(std::tuple<mem_type, size_t, size_t, uint32_t> &e) override;
   Return_t remove(const key_type &key) override;
-  void resize(LocalRDMAObj<hash_table_entry> *new_table, size_t size) override;
+  Return_t resize(LocalRDMAObj<hash_table_entry> *new_table,
+                  size_t size) override;
   size_t contains(const key_type &key) override;
+  bool relocate(const key_type &key, mem_type &to, uint32_t rkey) override;
   void dump(const size_t &, const size_t &) const;
   void dump() const override;
   void check_consistency() const override;
@@ -10,15 +10,12 @@
 #include <city.h>
 
 #include "hydra/keyspace.h"
+#include "hydra/key_hash.h"
 
 namespace hydra {
 template <typename T>
 inline hydra::keyspace_t::value_type hash(const T *s, size_t len) {
-  uint128 h = CityHash128(reinterpret_cast<const char *>(s), len);
-  return static_cast<hydra::keyspace_t::value_type>(
-      static_cast<__uint128_t>(Uint128High64(h))
-          << std::numeric_limits<std::uint64_t>::digits |
-      static_cast<__uint128_t>(Uint128Low64(h)));
+  return static_cast<hydra::keyspace_t::value_type>(key_hash::hash(s, len));
 }
 
 template <typename T>
@@ -1,5 +1,9 @@
 #include <iostream>
 #include <algorithm>
+#include <bitset>
+#include <array>
+
+#include <emmintrin.h>
 
 #include "util/utils.h"
 #include "hash.h"
@@ -35,48 +39,281 @@ size_t hydra::hopscotch_server::next_size() const {
   return std::min(max_size, proposed_next_size);
 }
 
+#if STRIPED_LOCKS
+class hydra::hopscotch_server::stripe_guard {
+  const hopscotch_server &hs;
+  std::bitset<Locks> held;
+  size_t first_stripe = 0;
+  size_t last_stripe = 0;
+  std::array<size_t, 4> neighbourhood;
+  size_t count = 0;
+  bool exclusive = false;
+  /* locks held are not a single range of the current table */
+  bool scattered = false;
+  std::vector<size_t> acquired;
+  bool contended_ = false;
+
+  size_t stripe_of(const size_t index) const { return index / hs.hop_range; }
+  size_t stripes() const {
+    return (hs.table_size + hs.hop_range - 1) / hs.hop_range;
+  }
+  size_t lock_of(const size_t stripe) const { return stripe % Locks; }
+
+  void lock(const size_t lock) {
+    if (!held.test(lock)) {
+      hs.locks[lock].lock();
+      held.set(lock);
+      if (scattered)
+        acquired.push_back(lock);
+    }
+  }
+
+  void unlock(const size_t lock) {
+    if (held.test(lock)) {
+      hs.locks[lock].unlock();
+      held.reset(lock);
+    }
+  }
+
+  bool try_lock(const size_t lock) {
+    if (held.test(lock))
+      return true;
+    if (!hs.locks[lock].try_lock())
+      return false;
+    held.set(lock);
+    if (scattered)
+      acquired.push_back(lock);
+    return true;
+  }
+
+public:
+  stripe_guard(const hopscotch_server &hs) : hs(hs) {}
+  stripe_guard(const stripe_guard &) = delete;
+  ~stripe_guard() { release(); }
+
+  /* Lock the stripes covering the neighbourhood of home and, while a resize is
+   * in progress, the neighbourhood of old_home in the old table.
+   */
+  void lock_neighbourhood(const size_t home, const size_t size,
+                          const size_t old_home = 0,
+                          const size_t old_size = 0) {
+    first_stripe = stripe_of(home);
+    last_stripe = stripe_of((home + hs.hop_range - 1) % size);
+    neighbourhood[0] = lock_of(first_stripe);
+    neighbourhood[1] = lock_of(last_stripe);
+    count = 2;
+    if (old_size) {
+      neighbourhood[count++] = lock_of(stripe_of(old_home));
+      neighbourhood[count++] =
+          lock_of(stripe_of((old_home + hs.hop_range - 1) % old_size));
+    }
+    std::sort(std::begin(neighbourhood), std::begin(neighbourhood) + count);
+    for (size_t i = 0; i < count; i++)
+      lock(neighbourhood[i]);
+  }
+
+  /* Lock the stripe of the old table holding old_stripe's homes and the one
+   * after it, which holds the tail of their neighbourhoods.
+   */
+  void lock_old_stripe(const size_t old_stripe, const size_t old_size) {
+    const size_t old_stripes = (old_size + hs.hop_range - 1) / hs.hop_range;
+    const size_t a = lock_of(old_stripe);
+    const size_t b = lock_of((old_stripe + 1) % old_stripes);
+    scattered = true;
+    lock(std::min(a, b));
+    lock(std::max(a, b));
+  }
+
+  /* Move on to the neighbourhood of home in the current table, keeping all
+   * locks held so far. Never waits.
+   */
+  bool try_neighbourhood(const size_t home) {
+    if (exclusive)
+      return true;
+    scattered = true;
+    first_stripe = stripe_of(home);
+    last_stripe = first_stripe;
+    if (!try_lock(lock_of(first_stripe))) {
+      contended_ = true;
+      return false;
+    }
+    return extend((home + hs.hop_range - 1) % hs.table_size);
+  }
+
+  void lock_all() {
+    for (size_t lock = 0; lock < Locks; lock++)
+      this->lock(lock);
+    exclusive = true;
+  }
+
+  /* Extend the locked range along the ring up to the stripe holding index.
+   * Never waits, so the ascending lock order can not be violated.
+   */
+  bool extend(const size_t index) {
+    if (exclusive)
+      return true;
+    const size_t target = stripe_of(index);
+    const size_t stripes = this->stripes();
+    const size_t locked = (last_stripe - first_stripe + stripes) % stripes;
+    if ((target - first_stripe + stripes) % stripes <= locked)
+      return true;
+    while (last_stripe != target) {
+      const size_t next = (last_stripe + 1) % stripes;
+      if (!try_lock(lock_of(next))) {
+        contended_ = true;
+        return false;
+      }
+      last_stripe = next;
+    }
+    return true;
+  }
+
+  bool contended() const noexcept { return contended_; }
+
+  void release() {
+    if (held.none())
+      return;
+    if (exclusive) {
+      for (size_t lock = 0; lock < Locks; lock++)
+        hs.locks[lock].unlock();
+    } else if (scattered) {
+      for (const size_t lock : acquired)
+        unlock(lock);
+      assert(held.none());
+    } else {
+      const size_t stripes = this->stripes();
+      for (size_t stripe = first_stripe;; stripe = (stripe + 1) % stripes) {
+        unlock(lock_of(stripe));
+        if (stripe == last_stripe)
+          break;
+      }
+      for (size_t i = 0; i < count; i++)
+        unlock(neighbourhood[i]);
+      assert(held.none());
+    }
+    held.reset();
+    count = 0;
+    acquired.clear();
+    exclusive = false;
+    scattered = false;
+    contended_ = false;
+  }
+};
+#endif
+
 size_t
 hydra::hopscotch_server::home_of(const hydra::server_dht::key_type &key) const {
-  __uint128_t h = hash(key.first, key.second);
-  return (h % table_size);
+  return home_of(key, table_size);
 }
 
-size_t hydra::hopscotch_server::next_free_index(size_t from) const {
-  auto free = [](const auto &e) {
-    e.lock();
-    if (!e) // empty
-      return true;
-    e.unlock();
+size_t hydra::hopscotch_server::home_of(const hydra::server_dht::key_type &key,
+                                       const size_t size) const {
+  return reduce(hash(key.first, key.second), size);
+}
+
+size_t hydra::hopscotch_server::find(const key_type &key,
+                                     const size_t home) const {
+  return find(shadow_table, key, home);
+}
+
+/* The slots of the 32 from home whose fingerprint byte is fingerprint. */
+static uint32_t matching(const std::vector<uint8_t> &fingerprints,
+                         const size_t size, const size_t home,
+                         const uint8_t fingerprint) {
+  if (home + 32 <= size) {
+    const auto p = reinterpret_cast<const __m128i *>(&fingerprints[home]);
+    const __m128i f = _mm_set1_epi8(static_cast<char>(fingerprint));
+    const auto low = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), f)));
+    const auto high = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), f)));
+    return low | (high << 16);
+  }
+  /* the neighbourhood wraps around or the table is tiny */
+  uint32_t mask = 0;
+  for (size_t i = 0; i < std::min<size_t>(32, size); i++) {
+    if (fingerprints[(home + i) % size] == fingerprint)
+      mask |= uint32_t(1) << i;
+  }
+  return mask;
+}
+
+/* Returns size + 1 if key is not in the neighbourhood of home. Only slots
+ * with the key's fingerprint have their key compared.
+ */
+size_t hydra::hopscotch_server::find(const shadow_table_t &shadow,
+                                     const key_type &key,
+                                     const size_t home) const {
+  const size_t size = shadow.size();
+  uint32_t hops = shadow.hops(home);
+  if (!hops)
+    return size + 1;
+  hops &= matching(shadow.fingerprints, size, home,
+                   static_cast<uint8_t>(
+                       fingerprint(hash(key.first, key.second))));
+  for (; hops; hops &= hops - 1) {
+    const size_t index = (home + __builtin_ctz(hops)) % size;
+    if (shadow.has_key(index, key))
+      return index;
+  }
+  return size + 1;
+}
+
+/* Requires the neighbourhood of old_home in the old table to be locked. */
+bool hydra::hopscotch_server::remove_old(const key_type &key,
+                                         const size_t old_home) {
+  const size_t kv = find(old_shadow_table, key, old_home);
+  if (kv >= old_size)
     return false;
-  };
 
-  return find_if(from, from, free);
+  const size_t distance = (kv - old_home + old_size) % old_size;
+  reclaimer.retire(old_shadow_table.clear(kv, old_home, distance));
+  used_--;
+  return true;
 }
 
+size_t hydra::hopscotch_server::next_free_index(size_t from,
+                                                stripe_guard &guard) const {
+  for (size_t i = 0, index = from; i < table_size;
+       i++, index = (index + 1) % table_size) {
+#if STRIPED_LOCKS
+    if (!guard.extend(index))
+      return invalid_index();
+#else
+    static_cast<void>(guard);
+#endif
+    if (!shadow_table.used(index))
+      return index;
+  }
+  return invalid_index();
+}
+
+/* Find an entry in the hop_range - 1 slots before to, which can be moved into
+ * to without leaving the neighbourhood of its home. All examined slots lie
+ * between the home of the entry being inserted and to, so they are covered by
+ * the stripes locked by next_free_index().
+ */
 size_t hydra::hopscotch_server::next_movable(size_t to) const {
   size_t start = (to - (hop_range - 1) + table_size) % table_size;
 
   for (size_t i = start; i != to; i = (i + 1) % table_size) {
-    const size_t home = home_of(table[i].get());
     const size_t distance = (to - i + table_size) % table_size;
-    /* racy */
-    for (size_t offset = 0; offset < distance; offset++) {
-      if (shadow_table[i].has_hop(offset)) {
-        return i + offset;
-      }
-    }
+    const uint32_t hops =
+        shadow_table.hops(i) & ((uint32_t(1) << distance) - 1);
+    if (hops)
+      return (i + __builtin_ctz(hops)) % table_size;
   }
   return invalid_index();
 }
 
-void
-hydra::hopscotch_server::add(std::tuple<mem_type, size_t, size_t, uint32_t> &e,
-                             const size_t to, const size_t home) {
+void hydra::hopscotch_server::add(const kv_type &kv, const size_t to,
+                                  const size_t home) {
   size_t distance = (to - home + table_size) % table_size;
   assert(distance < hop_range);
-  assert(std::get<0>(e));
-  shadow_table[to].set(shadow_table[home], distance, std::move(std::get<0>(e)),
-                       std::get<1>(e), std::get<2>(e), std::get<3>(e));
+  assert(kv.kv);
+  mem_type replaced = shadow_table.set(to, home, distance, kv);
+  if (replaced)
+    reclaimer.retire(std::move(replaced));
 }
 
 void hydra::hopscotch_server::move(size_t from, size_t to) {
@@ -88,160 +325,488 @@ void hydra::hopscotch_server::move(size_t from, size_t to) {
   assert(distance < hop_range);
   assert(old_hops < hop_range);
 
-  /* racy - move/hop update */
-  // add(std::move(shadow_table[from]), to, home);
-  shadow_table[to].into(std::move(shadow_table[from]), shadow_table[home],
-                        old_hops, distance);
+  shadow_table.move(from, to, home, old_hops, distance);
 }
 
 size_t hydra::hopscotch_server::move_into(size_t to) {
   size_t movable = next_movable(to);
   if (!index_valid(movable)) {
-    shadow_table[to].unlock();
     return movable;
   }
 
   move(movable, to);
-  shadow_table[to].unlock();
   return movable;
 }
 
-hydra::Return_t hydra::hopscotch_server::add(
-    std::tuple<mem_type, size_t, size_t, uint32_t> &e) {
-  key_type key(std::get<0>(e).get(), std::get<2>(e));
-
-  const size_t start = home_of(key);
-  const size_t end = (start + hop_range) % table_size;
-  const auto &home = shadow_table[start];
-  size_t hop = 0;
-
-  auto has_key_or_empty = [&home, &hop, &key](const auto &e) {
-    const auto i = hop++;
-    /* empty */
-    if (!e) {
-      return true;
-    } else if (!home.has_hop(i)) {
-      return false;
-    } else if (e.has_key(key)) {
-      return true;
-    }
-    return false;
-  };
-
-  auto index = find_if(start, end, has_key_or_empty);
+/* Requires the neighbourhood of home to be locked. */
+hydra::Return_t hydra::hopscotch_server::add(const kv_type &kv,
+                                             const size_t home,
+                                             stripe_guard &guard) {
+  key_type key(kv.kv, kv.key_size);
 
-  if (index != invalid_index()) {
-    add(e, index, home_of(key));
-    shadow_table[index].unlock();
+  const size_t existing = find(key, home);
+  if (index_valid(existing)) {
+    add(kv, existing, home);
     return SUCCESS;
   }
 
-  index = home_of(key);
-  for (size_t next = next_free_index(index); index_valid(next);
+  for (size_t next = next_free_index(home, guard); index_valid(next);
        next = move_into(next)) {
-    size_t distance = (next - index + table_size) % table_size;
+    size_t distance = (next - home + table_size) % table_size;
     if (distance < hop_range) {
-      add(e, next, index);
+      add(kv, next, home);
       used_++;
-      shadow_table[next].unlock();
       return SUCCESS;
     }
-    shadow_table[next].unlock();
   }
 
   return NEED_RESIZE;
 }
 
-size_t hydra::hopscotch_server::contains(const key_type &key) {
-  size_t start = home_of(key);
-  size_t end = (start + hop_range) % table_size;
-  const auto &home = shadow_table[start];
-  size_t index = 0;
-
-  auto has_key = [&](const auto &e) {
-    if (!home.has_hop(index++))
-      return false;
+hydra::Return_t hydra::hopscotch_server::add(
+    std::tuple<mem_type, size_t, size_t, uint32_t> &e) {
+  key_type key(std::get<0>(e).get(), std::get<2>(e));
 
-    e.lock();
-    if (e.has_key(key))
-      return true;
-    e.unlock();
-    return false;
-  };
+  /* A stalled migration means the new table is too small already. */
+  if (!migrate())
+    return NEED_RESIZE;
+
+  const kv_type kv{ std::get<0>(e).get(), std::get<1>(e), std::get<2>(e),
+                    std::get<3>(e), &std::get<0>(e) };
+  Return_t ret;
+#if STRIPED_LOCKS
+  for (;;) {
+    stripe_guard guard(*this);
+    const size_t size = published_size.load(std::memory_order_acquire);
+    const size_t old = published_old_size.load(std::memory_order_acquire);
+    const size_t home = home_of(key, size);
+    const size_t old_home = old ? home_of(key, old) : 0;
+
+    guard.lock_neighbourhood(home, size, old_home, old);
+    if (size != table_size || old != old_size)
+      continue;
+
+    ret = add(kv, home, guard);
+    if (ret == NEED_RESIZE && guard.contended()) {
+      /* displacement ran into a stripe held by another thread */
+      guard.release();
+      guard.lock_all();
+      if (size != table_size || old != old_size)
+        continue;
+      ret = add(kv, home, guard);
+    }
 
-  auto ret = find_if(start, end, has_key);
+    if (ret == SUCCESS && old_size)
+      remove_old(key, old_home);
+    break;
+  }
+#else
+  stripe_guard guard;
+  ret = add(kv, home_of(key), guard);
+  if (ret == SUCCESS && old_size)
+    remove_old(key, home_of(key, old_size));
+#endif
+  /* unless stored, the caller keeps the key/value to try again */
   return ret;
 }
 
+/* Returns the index of key in the table holding it, or invalid_index(). */
+size_t hydra::hopscotch_server::contains(const key_type &key) {
+#if STRIPED_LOCKS
+  for (;;) {
+    stripe_guard guard(*this);
+    const size_t size = published_size.load(std::memory_order_acquire);
+    const size_t old = published_old_size.load(std::memory_order_acquire);
+    const size_t home = home_of(key, size);
+    const size_t old_home = old ? home_of(key, old) : 0;
+
+    guard.lock_neighbourhood(home, size, old_home, old);
+    if (size != table_size || old != old_size)
+      continue;
+
+    const size_t index = find(key, home);
+    if (index_valid(index) || !old_size)
+      return index;
+    const size_t old_index = find(old_shadow_table, key, old_home);
+    return (old_index < old_size) ? old_index : invalid_index();
+  }
+#else
+  const size_t index = find(key, home_of(key));
+  if (index_valid(index) || !old_size)
+    return index;
+  const size_t old_index =
+      find(old_shadow_table, key, home_of(key, old_size));
+  return (old_index < old_size) ? old_index : invalid_index();
+#endif
+}
+
 hydra::Return_t hydra::hopscotch_server::remove(const key_type &key) {
-  const size_t kv = contains(key);
-  if (kv == invalid_index())
-    return NOTFOUND;
+  Return_t ret = NOTFOUND;
+  {
+#if STRIPED_LOCKS
+    stripe_guard guard(*this);
+    size_t home;
+    size_t old_home;
+    for (;;) {
+      const size_t size = published_size.load(std::memory_order_acquire);
+      const size_t old = published_old_size.load(std::memory_order_acquire);
+      home = home_of(key, size);
+      old_home = old ? home_of(key, old) : 0;
+
+      guard.lock_neighbourhood(home, size, old_home, old);
+      if (size == table_size && old == old_size)
+        break;
+      guard.release();
+    }
+#else
+    const size_t home = home_of(key);
+    const size_t old_home = old_size ? home_of(key, old_size) : 0;
+#endif
+
+    const size_t kv = find(key, home);
+    if (index_valid(kv)) {
+      const size_t distance = (kv - home + table_size) % table_size;
+      reclaimer.retire(shadow_table.clear(kv, home, distance));
+      used_--;
+      ret = SUCCESS;
+    } else if (old_size && remove_old(key, old_home)) {
+      ret = SUCCESS;
+    }
+  }
 
+  migrate();
+  return ret;
+}
+
+/* During a resize, key may not have been migrated yet. */
+bool hydra::hopscotch_server::relocate(const key_type &key, mem_type &to,
+                                       const uint32_t rkey) {
+#if STRIPED_LOCKS
+  stripe_guard guard(*this);
+  size_t home;
+  size_t old_home;
+  for (;;) {
+    const size_t size = published_size.load(std::memory_order_acquire);
+    const size_t old = published_old_size.load(std::memory_order_acquire);
+    home = home_of(key, size);
+    old_home = old ? home_of(key, old) : 0;
+
+    guard.lock_neighbourhood(home, size, old_home, old);
+    if (size == table_size && old == old_size)
+      break;
+    guard.release();
+  }
+#else
   const size_t home = home_of(key);
-  const size_t distance = (kv - home + table_size) % table_size;
-  shadow_table[kv].empty(shadow_table[home], distance);
-  shadow_table[kv].unlock();
-  used_--;
+  const size_t old_home = old_size ? home_of(key, old_size) : 0;
+#endif
 
-  return SUCCESS;
+  shadow_table_t *shadow = nullptr;
+  size_t index = find(key, home);
+  if (index_valid(index)) {
+    shadow = &shadow_table;
+  } else if (old_size) {
+    index = find(old_shadow_table, key, old_home);
+    if (index < old_size)
+      shadow = &old_shadow_table;
+  }
+
+  /* the key may have been stored again, at another address */
+  if (shadow == nullptr || shadow->kvs[index] != key.first)
+    return false;
+  reclaimer.retire(shadow->relocate(index, to, rkey));
+  return true;
 }
 
-void hydra::hopscotch_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
-                                     size_t size) {
-  ++rehash_count;
-  table_size = size;
-  table = new_table;
+bool hydra::hopscotch_server::resizing() const {
+#if STRIPED_LOCKS
+  return published_old_size.load(std::memory_order_acquire) != 0;
+#else
+  return old_size != 0;
+#endif
+}
 
-  std::vector<resource_entry> tmp_shadow_table;
-  tmp_shadow_table.reserve(table_size);
+/* Drain the next old homes into the current table. Returns false if
+ * an entry did not fit into the current table.
+ * The old stripe is locked and entries are inserted into the current table
+ * using try_lock only. If that fails, the stripe is drained holding all locks.
+ */
+bool hydra::hopscotch_server::migrate() {
+  if (!resizing())
+    return true;
+
+  shadow_table_t retired;
+  bool success = true;
+#if STRIPED_LOCKS
+  if (migrating.test_and_set(std::memory_order_acquire))
+    return true;
+  {
+    stripe_guard guard(*this);
+    size_t size;
+    size_t old;
+    for (;;) {
+      size = published_size.load(std::memory_order_acquire);
+      old = published_old_size.load(std::memory_order_acquire);
+      const size_t from = migrated.load(std::memory_order_relaxed);
+      if (!old)
+        break;
+      guard.lock_old_stripe(from / hop_range, old);
+      if (size == table_size && old == old_size && from == migrated)
+        break;
+      guard.release();
+    }
 
-  for (size_t i = 0; i < table_size; i++) {
-    new (&table[i]) LocalRDMAObj<hash_table_entry>;
-    tmp_shadow_table.emplace_back(table[i]);
+    if (old) {
+      success = migrate(guard);
+      if (!success && guard.contended()) {
+        guard.release();
+        guard.lock_all();
+        /* a resize in between has drained the old table already */
+        success = (size != table_size || old != old_size) || migrate(guard);
+      }
+      if (success && migrated == old) {
+        guard.release();
+        guard.lock_all();
+        if (size == table_size && old == old_size) {
+          std::swap(retired, old_shadow_table);
+          old_size = 0;
+          migrated = 0;
+          published_old_size.store(0, std::memory_order_release);
+        }
+      }
+    }
   }
+  migrating.clear(std::memory_order_release);
+#else
+  stripe_guard guard;
+  success = migrate(guard);
+  if (success && migrated == old_size) {
+    std::swap(retired, old_shadow_table);
+    old_size = 0;
+    migrated = 0;
+  }
+#endif
+  return success;
+}
 
-  std::swap(shadow_table, tmp_shadow_table);
-  used_ = 0;
+/* Requires the old stripe at migrated to be locked. A quarter of a stripe is
+ * drained per call, which finishes a resize long before the new table fills.
+ */
+bool hydra::hopscotch_server::migrate(stripe_guard &guard) {
+  const size_t batch = std::max<size_t>(hop_range / 4, 1);
+  const size_t last =
+      std::min({ migrated + batch, (migrated / hop_range + 1) * hop_range,
+                 old_size });
+  for (; migrated < last; migrated++) {
+    if (!migrate(migrated, guard))
+      return false;
+  }
+  return true;
+}
 
-  for (auto &&entry : tmp_shadow_table) {
-    if (entry) {
-      auto tmp = std::make_tuple(std::move(entry.mem), entry.size(),
-                                 entry.key_size(), entry.rkey());
-      add(tmp);
+/* Entries are inserted into the current table before they are removed from
+ * the old one, so readers looking in the old table first always find them.
+ */
+bool hydra::hopscotch_server::migrate(const size_t old_home,
+                                      stripe_guard &guard) {
+  for (size_t hop = 0; hop < hop_range; hop++) {
+    if (!(old_shadow_table.hops(old_home) & (1U << hop)))
+      continue;
+    const size_t index = (old_home + hop) % old_size;
+    const kv_type kv = old_shadow_table.get(index);
+    const size_t home = home_of(key_type(kv.kv, kv.key_size));
+#if STRIPED_LOCKS
+    if (!guard.try_neighbourhood(home))
+      return false;
+#endif
+    if (add(kv, home, guard) != SUCCESS)
+      return false;
+    /* the owner moves along */
+    old_shadow_table.clear(index, old_home, hop);
+    used_--;
+  }
+  return true;
+}
+
+/* Sets up the slots and the shadow table of new_table without taking any
+ * stripe lock.
+ */
+void hydra::hopscotch_server::prepare(LocalRDMAObj<hash_table_entry> *new_table,
+                                      size_t size) {
+  shadow_table_t next(new_table, size);
+  std::unique_lock<hydra::spinlock> l(prepared_lock);
+  std::swap(prepared, next);
+}
+
+/* Starts an incremental resize; the current table becomes the old table.
+ * Unless prepare() has set up new_table already, this is done before any lock
+ * is taken.
+ */
+hydra::Return_t
+hydra::hopscotch_server::resize(LocalRDMAObj<hash_table_entry> *new_table,
+                                size_t size) {
+  shadow_table_t next;
+  {
+    std::unique_lock<hydra::spinlock> l(prepared_lock);
+    if (prepared.entries == new_table && prepared.size() == size)
+      std::swap(next, prepared);
+  }
+  if (!next.entries) {
+    shadow_table_t fresh(new_table, size);
+    std::swap(next, fresh);
+  }
+
+#if STRIPED_LOCKS
+  stripe_guard guard(*this);
+  guard.lock_all();
+#else
+  stripe_guard guard;
+#endif
+  return resize(next, guard);
+  /* next now holds the retired shadow table, which is released after the
+   * locks are. */
+}
+
+/* Migrates everything left holding all locks, so a caller can stop
+ * advertising the old table before the next resize().
+ */
+bool hydra::hopscotch_server::drain() {
+  if (!resizing())
+    return true;
+
+  shadow_table_t retired;
+#if STRIPED_LOCKS
+  stripe_guard guard(*this);
+  guard.lock_all();
+#else
+  stripe_guard guard;
+#endif
+  while (migrated < old_size) {
+    if (!migrate(guard))
+      return false;
+  }
+  std::swap(retired, old_shadow_table);
+  old_size = 0;
+  migrated = 0;
+#if STRIPED_LOCKS
+  published_old_size.store(0, std::memory_order_release);
+#endif
+  return true;
+}
+
+/* Requires all locks to be held. If the previous resize has not finished, it
+ * is finished into the current table as far as that goes, and the entries
+ * left are moved into the new table right away. If one of them does not fit,
+ * the moved ones are put back and the resize is abandoned, leaving next as it
+ * was.
+ */
+hydra::Return_t hydra::hopscotch_server::resize(shadow_table_t &next,
+                                                stripe_guard &guard) {
+  while (migrated < old_size && migrate(guard)) {
+  }
+
+  const size_t previous_old_size = old_size;
+  const size_t previous_migrated = migrated;
+  shadow_table_t remaining;
+  std::swap(remaining, old_shadow_table);
+
+  if (shadow_table.entries) {
+    old_size = table_size;
+    std::swap(old_shadow_table, shadow_table);
+  }
+  migrated = 0;
+
+  table = next.entries;
+  table_size = next.size();
+  std::swap(shadow_table, next);
+
+  std::vector<size_t> moved;
+  Return_t ret = SUCCESS;
+  for (size_t i = 0; i < remaining.size() && ret == SUCCESS; i++) {
+    if (!remaining.used(i))
+      continue;
+    const kv_type kv = remaining.get(i);
+    ret = add(kv, home_of(key_type(kv.kv, kv.key_size)), guard);
+    if (ret == SUCCESS)
+      moved.push_back(i);
+  }
+
+  if (ret != SUCCESS) {
+    for (const size_t i : moved) {
+      const key_type key(remaining.kvs[i],
+                         remaining.entries[i].get().key_length());
+      const size_t home = home_of(key);
+      const size_t index = find(key, home);
+      assert(index_valid(index));
+      remaining.owners[i] = shadow_table.clear(
+          index, home, (index - home + table_size) % table_size);
+      used_--;
     }
+    std::swap(next, shadow_table);
+    std::swap(shadow_table, old_shadow_table);
+    std::swap(old_shadow_table, remaining);
+    table = shadow_table.entries;
+    table_size = shadow_table.size();
+    old_size = previous_old_size;
+    migrated = previous_migrated;
+    return ret;
   }
+
+  /* moved entries were counted in the old table already */
+  used_ -= moved.size();
+  std::swap(next, remaining);
+  ++rehash_count;
+#if STRIPED_LOCKS
+  published_old_size.store(old_size, std::memory_order_release);
+  published_size.store(table_size, std::memory_order_release);
+#endif
+  return SUCCESS;
 }
 
-void hydra::hopscotch_server::dump() const { dump(0, table_size); }
+void hydra::hopscotch_server::dump() const {
+#if STRIPED_LOCKS
+  stripe_guard guard(*this);
+  guard.lock_all();
+#endif
+  dump(0, table_size);
+}
 void hydra::hopscotch_server::dump(const size_t &from, const size_t &to) const {
   for (size_t i = from; i < to; i++) {
-    auto &e = shadow_table[i];
-    if (e)
-      std::cout << &e << " " << std::setw(6) << i << " " << e.entry.get()
-                << std::endl;
+    if (shadow_table.used(i))
+      std::cout << std::setw(6) << i << " "
+                << shadow_table.entries[i].get() << std::endl;
   }
 }
 
 void hydra::hopscotch_server::check_consistency() const {
 #ifndef NDEBUG
-  for (size_t i = 0; i < table_size; i++) {
-    const auto &shadow_entry = shadow_table[i];
-    const auto &rdma_entry = table[i];
-    if ((shadow_entry.mem.get() != rdma_entry.get().key()) ||
-        (shadow_entry.rkey() != rdma_entry.get().rkey) ||
-        (shadow_entry.size() != rdma_entry.get().ptr.size) ||
-        (shadow_entry.key_size() != rdma_entry.get().key_size) ||
-        (!rdma_entry.valid()) ||
-        (rdma_entry.get().rkey == 0 && (rdma_entry.get().hop & 1))) {
-      std::cout << i << " " << shadow_entry << std::endl;
-      std::cout << std::boolalpha << "valid: " << rdma_entry.valid()
-                << std::endl;
-      std::cout << rdma_entry.get() << std::endl;
-      dump();
-      std::terminate();
+#if STRIPED_LOCKS
+  stripe_guard guard(*this);
+  guard.lock_all();
+#endif
+  auto check = [this](const shadow_table_t &shadow) {
+    for (size_t i = 0; i < shadow.size(); i++) {
+      const auto &rdma_entry = shadow.entries[i];
+      const value_type *kv = shadow.kvs[i];
+      if ((kv != rdma_entry.get().key()) ||
+          (kv != shadow.owners[i].get()) ||
+          (shadow.fingerprints[i] !=
+           static_cast<uint8_t>(rdma_entry.get().fingerprint)) ||
+          (!rdma_entry.valid()) ||
+          (rdma_entry.get().rkey == 0 && (rdma_entry.get().hop & 1))) {
+        std::cout << i << " " << static_cast<const void *>(kv) << " owner "
+                  << static_cast<const void *>(shadow.owners[i].get())
+                  << std::endl;
+        std::cout << std::boolalpha << "valid: " << rdma_entry.valid()
+                  << std::endl;
+        std::cout << rdma_entry.get() << std::endl;
+        dump(0, table_size);
+        std::terminate();
+      }
     }
-  }
+  };
+  check(shadow_table);
+  if (old_size)
+    check(old_shadow_table);
 #endif
 }
-
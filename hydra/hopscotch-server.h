@@ -1,181 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
 #include <utility>
+#include <vector>
 
 #include "server_dht.h"
 #include "util/Logger.h"
+#include "util/utils.h"
 
 namespace hydra {
 
 class hopscotch_server : public server_dht {
-  struct resource_entry {
-    mem_type mem;
-    server_entry &entry;
+  /* A key/value on its way into a table. owner is moved into the slot the
+   * key/value ends up in, and is left alone if it does not fit.
+   */
+  struct kv_type {
+    const value_type *kv;
+    size_t size;
+    size_t key_size;
+    uint32_t rkey;
+    mem_type *owner;
+  };
 
-#if PER_ENTRY_LOCKS
-    mutable hydra::spinlock lock_;
-#endif
+  /* The server's side of a table, as a structure of arrays: per slot, the
+   * key/value its entry points to (nullptr if the slot is free), the owner of
+   * the key/value and the low byte of the key's fingerprint, which find()
+   * compares for a whole neighbourhood at once. Probes do not touch the
+   * owners, whose deleters make them large. A slot, its owner included, is
+   * guarded by the slot's stripe lock. Methods updating a slot keep its RDMA
+   * entry in sync.
+   */
+  struct shadow_table_t {
+    LocalRDMAObj<hash_table_entry> *entries = nullptr;
+    std::vector<const value_type *> kvs;
+    std::vector<mem_type> owners;
+    std::vector<uint8_t> fingerprints;
+
+    shadow_table_t() = default;
+    /* sets up the slots of entries as well */
+    shadow_table_t(LocalRDMAObj<hash_table_entry> *entries, const size_t size)
+        : entries(entries), kvs(size), owners(size), fingerprints(size) {
+      for (size_t i = 0; i < size; i++)
+        new (&entries[i]) LocalRDMAObj<hash_table_entry>;
+    }
 
-  public:
-    // resource_entry() = default;
-    resource_entry(resource_entry &&other) = default;
-#if PER_ENTRY_LOCKS
-    resource_entry &operator=(resource_entry &&other) {
-      /* if other lock is taken, take ours */
-
-      if (!other.lock_.try_lock())
-        lock_.try_lock();
-      mem = std::move(other.mem);
-      other.lock_.unlock();
-      return *this;
+    size_t size() const noexcept { return kvs.size(); }
+    bool used(const size_t index) const noexcept {
+      assert((kvs[index] != nullptr) == bool(entries[index].get()));
+      return kvs[index] != nullptr;
     }
-#else
-    resource_entry &operator=(resource_entry &&other) {
-      assert(other);
-      assert(!*this);
-      mem = std::move(other.mem);
-      entry = std::move(other.entry);
-      return *this;
+    uint32_t hops(const size_t index) const noexcept {
+      return entries[index].get().hop;
     }
-#endif
-    explicit resource_entry(server_entry &entry) : entry(entry) {}
-    const value_type *key() const { return mem.get(); }
-    void set(resource_entry &home, const size_t &distance, mem_type ptr,
-             size_t size, size_t key_size, uint32_t rkey) {
-      mem = std::move(ptr);
-      uint32_t hop = entry.get().hop;
-      new (&entry) server_entry(mem.get(), size, key_size, rkey, hop);
-
-      /* racy? */
-      home.entry([&](auto &&entry) { entry.set_hop(distance); });
+    bool has_key(const size_t index, const key_type &key) const noexcept {
+      return (entries[index].get().key_length() == key.second) &&
+             std::equal(kvs[index], kvs[index] + key.second, key.first);
     }
-    void into(resource_entry other, resource_entry &home,
-              const size_t old_distance, const size_t new_distance) {
-      assert(other);
-      assert(!*this);
-
-      /* copy and reset -- leaving the hop information intact.
-       * other might be the same as home.
-       */
-      entry = other.entry;
-      other.entry([&](auto &&entry) { entry.empty(); });
 
-      /* update the hop information word */
-      home.entry([&](auto &&entry) {
+    /* Stores kv in slot index and marks it in the hop word of home, distance
+     * slots before. Returns the key/value replaced, if any.
+     */
+    mem_type set(const size_t index, const size_t home, const size_t distance,
+                 const kv_type &kv) {
+      mem_type replaced = std::move(owners[index]);
+      kvs[index] = kv.kv;
+      owners[index] = std::move(*kv.owner);
+      const uint32_t hop = entries[index].get().hop;
+      new (&entries[index])
+          server_entry(kv.kv, kv.size, kv.key_size, kv.rkey, hop);
+      fingerprints[index] =
+          static_cast<uint8_t>(entries[index].get().fingerprint);
+      entries[home]([&](auto &&entry) { entry.set_hop(distance); });
+      return replaced;
+    }
+    /* Points the slot at a copy of its key/value, which it takes from owner.
+     * Returns the key/value it had so far.
+     */
+    mem_type relocate(const size_t index, mem_type &owner,
+                      const uint32_t rkey) {
+      const value_type *kv = owner.get();
+      std::swap(owners[index], owner);
+      kvs[index] = kv;
+      entries[index]([&](auto &&entry) {
+        entry.point_to(kv, entry.ptr.size, entry.key_length());
+        entry.rkey = rkey;
+      });
+      return std::move(owner);
+    }
+    /* Moves the key/value of slot from into the free slot to, leaving the
+     * hop words but the one of home intact. from might be home.
+     */
+    void move(const size_t from, const size_t to, const size_t home,
+              const size_t old_distance, const size_t new_distance) {
+      assert(used(from));
+      assert(!used(to));
+      entries[to] = entries[from];
+      entries[from]([](auto &&entry) { entry.empty(); });
+      kvs[to] = kvs[from];
+      kvs[from] = nullptr;
+      owners[to] = std::move(owners[from]);
+      fingerprints[to] = fingerprints[from];
+      fingerprints[from] = 0;
+
+      entries[home]([&](auto &&entry) {
         entry.set_hop(new_distance);
         entry.clear_hop(old_distance);
       });
-
-      /* move resources */
-      mem = std::move(other.mem);
-    }
-    operator bool() const noexcept {
-      assert(bool(mem) == bool(entry.get()));
-      return bool(mem);
-    }
-    void empty(resource_entry &home, const size_t distance) {
-      home.entry([&](auto &&entry) { entry.clear_hop(distance); });
-      entry([](auto &&entry) { entry.empty(); });
-      mem.reset();
-      assert(mem.get() == nullptr);
     }
-    size_t size() const noexcept { return entry.get().ptr.size; }
-    size_t key_size() const noexcept { return entry.get().key_size; }
-    uint32_t rkey() const noexcept { return entry.get().rkey; }
-    bool has_hop(const size_t &idx) const noexcept {
-      return entry.get().hop & (1 << idx);
+    /* Frees the slot index, distance slots after home. Returns its owner,
+     * whose key/value readers may still be reading.
+     */
+    mem_type clear(const size_t index, const size_t home,
+                   const size_t distance) {
+      assert(used(index));
+      entries[home]([&](auto &&entry) { entry.clear_hop(distance); });
+      entries[index]([](auto &&entry) { entry.empty(); });
+      kvs[index] = nullptr;
+      fingerprints[index] = 0;
+      return std::move(owners[index]);
     }
-    bool has_key(const key_type &other_key) const noexcept {
-      return (key_size() == other_key.second) &&
-             std::equal(key(), key() + key_size(), other_key.first);
-    }
-    void lock() const noexcept {
-#if PER_ENTRY_LOCKS
-      lock_.lock();
-#endif
-    }
-    void unlock() const noexcept {
-#if PER_ENTRY_LOCKS
-      lock_.unlock();
-#endif
-    }
-    void debug() noexcept {
-#if PER_ENTRY_LOCKS
-      lock_.__debug();
-#endif
-    }
-
-    friend std::ostream &operator<<(
-        std::ostream &s, const hydra::hopscotch_server::resource_entry &e) {
-      s << "ptr: " << static_cast<void *>(e.mem.get()) << std::endl;
-      s << "size: " << e.size() << std::endl;
-      s << "key_size: " << e.key_size() << std::endl;
-      s << "rkey: " << e.rkey();
-      return s;
+    /* The key/value of slot index, to be moved into another slot. */
+    kv_type get(const size_t index) {
+      const auto &entry = entries[index].get();
+      return { kvs[index], entry.ptr.size, entry.key_length(), entry.rkey,
+               &owners[index] };
     }
   };
 
   const size_t hop_range;
-  std::vector<resource_entry> shadow_table;
+  shadow_table_t shadow_table;
+
+  /* During a resize, the previous table is drained into the new one
+   * incrementally. Each key lives in exactly one of the two tables. Every
+   * add/remove moves the entries of a few old homes, starting at migrated.
+   * old_size is 0 if no resize is in progress.
+   */
+  shadow_table_t old_shadow_table;
+  size_t old_size = 0;
+  std::atomic<size_t> migrated{0};
+  /* set up by prepare() for the next resize() */
+  shadow_table_t prepared;
+  hydra::spinlock prepared_lock;
+
+#if STRIPED_LOCKS
+  /* Stripe i guards the slots [i * hop_range, (i + 1) * hop_range), so every
+   * neighbourhood lies within at most two stripes. Stripes map onto a fixed
+   * pool of locks, which thus survives a resize.
+   * Locks are only ever waited on in ascending order. Acquiring additional
+   * stripes while displacing is done with try_lock; if that fails the
+   * operation is retried holding all locks.
+   */
+  enum { Locks = 1024 };
+  struct alignas(LEVEL1_DCACHE_LINESIZE) stripe_lock : public hydra::spinlock {};
+  class stripe_guard;
+  using stripe_allocator = util::aligned_allocator<stripe_lock>;
+  mutable std::vector<stripe_lock, stripe_allocator> locks;
+  /* table_size/old_size for threads which do not hold any lock yet */
+  std::atomic<size_t> published_size;
+  std::atomic<size_t> published_old_size;
+  /* only one thread migrates at a time */
+  std::atomic_flag migrating = ATOMIC_FLAG_INIT;
+#else
+  class stripe_guard {};
+#endif
 
   size_t home_of(const hash_table_entry &e) const {
-    return home_of(std::make_pair(e.key(), e.key_size));
-  }
-
-  template <typename Pred>
-  size_t find_if(const size_t begin, const size_t end, Pred &&predicate) const {
-    if (begin < end) {
-      auto first = std::begin(shadow_table) + begin;
-      auto last = std::begin(shadow_table) + end;
-      auto result = std::find_if(first, last, predicate);
-      if (result != last)
-        return std::distance(std::begin(shadow_table), result);
-
-      return invalid_index();
-    } else {
-      auto first = std::begin(shadow_table) + begin;
-      auto last = std::end(shadow_table);
-      auto result = std::find_if(first, last, predicate);
-      if (result != last)
-        return std::distance(std::begin(shadow_table), result);
-
-      first = std::begin(shadow_table);
-      last = std::begin(shadow_table) + begin;
-      result = std::find_if(first, last, predicate);
-      if (result != last)
-        return std::distance(std::begin(shadow_table), result);
-
-      return invalid_index();
-    }
+    return home_of(std::make_pair(e.key(), e.key_length()));
   }
 
   size_t home_of(const key_type &key) const;
-  size_t next_free_index(size_t from) const;
+  size_t home_of(const key_type &key, const size_t size) const;
+  size_t find(const key_type &key, const size_t home) const;
+  size_t find(const shadow_table_t &shadow, const key_type &key,
+              const size_t home) const;
+  bool remove_old(const key_type &key, const size_t old_home);
+  size_t next_free_index(size_t from, stripe_guard &guard) const;
   size_t next_movable(size_t to) const;
-  void add(std::tuple<mem_type, size_t, size_t, uint32_t> &e, const size_t to,
-           const size_t home);
+  void add(const kv_type &kv, const size_t to, const size_t home);
+  Return_t add(const kv_type &kv, const size_t home, stripe_guard &guard);
   void move(size_t from, size_t to);
   size_t move_into(size_t to);
+  Return_t resize(shadow_table_t &next, stripe_guard &guard);
+  bool migrate();
+  bool migrate(stripe_guard &guard);
+  bool migrate(const size_t old_home, stripe_guard &guard);
 
 public:
   hopscotch_server(LocalRDMAObj<hash_table_entry> *table, size_t hop_range = 32,
                    size_t initial_size = 32)
-      : hop_range(hop_range) {
+      : hop_range(hop_range)
+#if STRIPED_LOCKS
+        ,
+        locks(Locks), published_size(0), published_old_size(0)
+#endif
+  {
     assert(
         ("Number of hops must be <= the number of bits in the type of the hop "
          "mask.",
          hop_range <=
              std::numeric_limits<decltype(hash_table_entry::hop)>::digits));
     log_info() << "sizeof(key_entry): " << sizeof(hash_table_entry);
-    log_info() << "sizeof(resource_entry): " << sizeof(resource_entry);
-    log_info() << "sizeof(mem_type): " << sizeof(mem_type);
+    log_info() << "shadow bytes per slot: "
+               << sizeof(value_type *) + sizeof(mem_type) + sizeof(uint8_t);
     resize(table, initial_size);
   }
   hopscotch_server(const hopscotch_server &) = delete;
   hopscotch_server(hopscotch_server &&) = default;
   Return_t add(std::tuple<mem_type, size_t, size_t, uint32_t> &e) override;
   Return_t remove(const key_type &key) override;
-  void resize(LocalRDMAObj<hash_table_entry> *new_table, size_t size) override;
+  Return_t resize(LocalRDMAObj<hash_table_entry> *new_table,
+                  size_t size) override;
+  void prepare(LocalRDMAObj<hash_table_entry> *new_table,
+               size_t size) override;
+  bool drain() override;
   size_t contains(const key_type &key) override;
+  bool relocate(const key_type &key, mem_type &to, uint32_t rkey) override;
   size_t next_size() const override;
+  bool resizing() const override;
   void dump(const size_t &, const size_t &) const;
   void dump() const override;
   void check_consistency() const override;
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <nmmintrin.h>
+
+#include <city.h>
+
+/* Hash which places keys in the keyspace and in the table: 0 for CityHash128
+ * truncated to 64 bits, 1 for CityHash64, 2 for wyhash, 3 for CRC32C. Clients
+ * and nodes have to agree.
+ */
+#ifndef KEY_HASH
+#define KEY_HASH 2
+#endif
+
+namespace hydra {
+
+/* Key hashes provide
+ *   static uint64_t hash(const void *p, size_t size);
+ *   static void hash(const unsigned char *const *keys, const size_t *sizes,
+ *                    size_t n, uint64_t *hashes);
+ * the latter for a batch of keys. batch_hash implements it key by key, which
+ * lets the CPU overlap the hashes of independent keys.
+ */
+template <typename Hash> struct batch_hash {
+  static void hash(const unsigned char *const *keys, const size_t *sizes,
+                   const size_t n, uint64_t *hashes) {
+    for (size_t i = 0; i < n; i++)
+      hashes[i] = Hash::hash(keys[i], sizes[i]);
+  }
+};
+
+struct city128_hash : batch_hash<city128_hash> {
+  using batch_hash<city128_hash>::hash;
+  static uint64_t hash(const void *p, const size_t size) {
+    return Uint128Low64(CityHash128(static_cast<const char *>(p), size));
+  }
+};
+
+struct city64_hash : batch_hash<city64_hash> {
+  using batch_hash<city64_hash>::hash;
+  static uint64_t hash(const void *p, const size_t size) {
+    return CityHash64(static_cast<const char *>(p), size);
+  }
+};
+
+/* after wyhash (final 4), with its default secret and a seed of 0 */
+struct wy_hash : batch_hash<wy_hash> {
+  using batch_hash<wy_hash>::hash;
+
+  static uint64_t hash(const void *key, const size_t size) {
+    const auto p = static_cast<const unsigned char *>(key);
+    uint64_t seed = mix(Secret0, Secret1);
+    uint64_t a, b;
+    if (size <= 16) {
+      if (size >= 4) {
+        const size_t offset = (size >> 3) << 2;
+        a = (read4(p) << 32) | read4(p + offset);
+        b = (read4(p + size - 4) << 32) | read4(p + size - 4 - offset);
+      } else if (size > 0) {
+        a = (uint64_t(p[0]) << 16) | (uint64_t(p[size >> 1]) << 8) |
+            p[size - 1];
+        b = 0;
+      } else {
+        a = b = 0;
+      }
+    } else {
+      const unsigned char *q = p;
+      size_t i = size;
+      if (i > 48) {
+        uint64_t seed1 = seed;
+        uint64_t seed2 = seed;
+        do {
+          seed = mix(read8(q) ^ Secret1, read8(q + 8) ^ seed);
+          seed1 = mix(read8(q + 16) ^ Secret2, read8(q + 24) ^ seed1);
+          seed2 = mix(read8(q + 32) ^ Secret3, read8(q + 40) ^ seed2);
+          q += 48;
+          i -= 48;
+        } while (i > 48);
+        seed ^= seed1 ^ seed2;
+      }
+      while (i > 16) {
+        seed = mix(read8(q) ^ Secret1, read8(q + 8) ^ seed);
+        q += 16;
+        i -= 16;
+      }
+      a = read8(q + i - 16);
+      b = read8(q + i - 8);
+    }
+    a ^= Secret1;
+    b ^= seed;
+    multiply(a, b);
+    return mix(a ^ Secret0 ^ size, b ^ Secret1);
+  }
+
+private:
+  static constexpr uint64_t Secret0 = 0x2d358dccaa6c78a5ull;
+  static constexpr uint64_t Secret1 = 0x8bb84b93962eacc9ull;
+  static constexpr uint64_t Secret2 = 0x4b33a62ed433d4a3ull;
+  static constexpr uint64_t Secret3 = 0x4d5a2da51de1aa47ull;
+
+  static void multiply(uint64_t &a, uint64_t &b) {
+    const __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+  }
+  static uint64_t mix(uint64_t a, uint64_t b) {
+    multiply(a, b);
+    return a ^ b;
+  }
+  static uint64_t read8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  static uint64_t read4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+};
+
+/* Two CRC32C lanes over the key, the second one over the words rotated by 32
+ * bits, finished by the MurmurHash3 mixer: the CRC is linear, the reduction
+ * onto the table needs its high bits to be good. Without SSE4.2, it falls
+ * back to CityHash64.
+ */
+struct crc_hash : batch_hash<crc_hash> {
+  using batch_hash<crc_hash>::hash;
+
+  static uint64_t hash(const void *key, const size_t size) {
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (!sse42)
+      return city64_hash::hash(key, size);
+    return hardware(static_cast<const unsigned char *>(key), size);
+  }
+
+private:
+  static constexpr uint64_t Seed0 = 0x9e3779b97f4a7c15ull;
+  static constexpr uint64_t Seed1 = 0xc2b2ae3d27d4eb4full;
+
+  static uint64_t read8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  static uint64_t read4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  __attribute__((target("sse4.2"))) static void
+  update(uint64_t &a, uint64_t &b, const uint64_t word) {
+    a = _mm_crc32_u64(a, word);
+    b = _mm_crc32_u64(b, (word << 32) | (word >> 32));
+  }
+
+  __attribute__((target("sse4.2"))) static uint64_t
+  hardware(const unsigned char *p, const size_t size) {
+    uint64_t a = Seed0 ^ size;
+    uint64_t b = Seed1;
+    size_t i = size;
+    for (; i >= 8; p += 8, i -= 8)
+      update(a, b, read8(p));
+    /* the rest is read like wyhash does; the length is in the seed */
+    if (i >= 4)
+      update(a, b, (read4(p) << 32) | read4(p + i - 4));
+    else if (i > 0)
+      update(a, b,
+             (uint64_t(p[0]) << 16) | (uint64_t(p[i >> 1]) << 8) | p[i - 1]);
+
+    uint64_t h = (a << 32) | static_cast<uint32_t>(b);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+};
+
+#if KEY_HASH == 0
+using key_hash = city128_hash;
+#elif KEY_HASH == 1
+using key_hash = city64_hash;
+#elif KEY_HASH == 2
+using key_hash = wy_hash;
+#else
+using key_hash = crc_hash;
+#endif
+
+/* Maps a hash onto [0, size) with a multiplication instead of a division
+ * (Lemire's fast range). size need not be a power of two.
+ * The fast range alone picks the slot by the high bits of h. Those are the
+ * bits a node's keyspace range fixes (nodes are responsible for contiguous
+ * ranges of the same hash), so with n nodes all keys of a node would land in
+ * 1/n of its table. Multiplying by an odd constant first carries the low
+ * bits into the high ones.
+ */
+inline size_t reduce(const uint64_t h, const size_t size) {
+  const uint64_t mixed = h * 0x9e3779b97f4a7c15ull;
+  return static_cast<size_t>((static_cast<__uint128_t>(mixed) * size) >> 64);
+}
+
+/* Tells keys of a neighbourhood apart without comparing them. Taken from the
+ * low bits of the hash, so keys sharing a home still differ in it.
+ */
+inline uint32_t fingerprint(const uint64_t h) {
+  return static_cast<uint32_t>(h);
+}
+}
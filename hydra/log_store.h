@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+
+#include "util/concurrent.h"
+#include "allocators/HeapStats.h"
+
+namespace hydra {
+
+/* Log-structured storage of key/value pairs. Pairs are appended to segments of
+ * registered memory, taken from SuperHeap, and are not moved on their own. A
+ * segment goes back to SuperHeap once all of its pairs have been freed.
+ *
+ * Segments which are mostly garbage are compacted by clean(): it copies their
+ * live pairs to the head of the log and has the owner of each pair point its
+ * entry at the copy. Both copies hold the same bytes, so a reader verifying
+ * the pair against the checksum of the entry it read is fine with either. The
+ * previous location has to go through an epoch_reclaimer, like any other
+ * overwritten pair.
+ *
+ * Pairs larger than a segment get a segment of their own.
+ */
+template <typename SuperHeap, size_t segmentSize> class log_store {
+public:
+  template <typename T>
+  using pointer_t = typename SuperHeap::template pointer_t<T>;
+  template <typename T>
+  using rdma_ptr = typename SuperHeap::template rdma_ptr<T>;
+
+  /* Points the entry of the pair at from to copy, and takes copy, unless the
+   * pair has been overwritten or removed meanwhile.
+   */
+  using relocate_t = std::function<bool(
+      const unsigned char *from, size_t key_size, rdma_ptr<unsigned char> &)>;
+
+private:
+  static constexpr uint32_t Dead = uint32_t(1) << 31;
+
+  /* precedes every pair */
+  struct alignas(8) record {
+    /* Dead is set once the pair has been freed */
+    std::atomic<uint32_t> size;
+    uint32_t key_size;
+  };
+
+  struct segment {
+    rdma_ptr<char> mem;
+    const size_t size;
+    /* bytes appended, under lock */
+    size_t head;
+    /* bytes of records not freed yet, plus one while the segment is the head
+     * of the log or being cleaned
+     */
+    std::atomic<size_t> live;
+    bool cleaning;
+
+    segment(rdma_ptr<char> mem, const size_t size)
+        : mem(std::move(mem)), size(size), head(0), live(1), cleaning(false) {}
+    char *base() const { return mem.first.get(); }
+  };
+
+  static size_t footprint(const size_t size) {
+    return (sizeof(record) + size + alignof(record) - 1) &
+           ~(alignof(record) - 1);
+  }
+
+  SuperHeap superHeap;
+  spinlock lock;
+  std::vector<std::unique_ptr<segment> > segments;
+  segment *open = nullptr;
+
+  /* caller holds lock */
+  segment *add_segment(const size_t size) {
+    segments.push_back(std::make_unique<segment>(
+        superHeap.template malloc<char>(size), size));
+    return segments.back().get();
+  }
+
+  void release(segment *s, const size_t bytes) {
+    if (s->live.fetch_sub(bytes, std::memory_order_acq_rel) != bytes)
+      return;
+    std::unique_ptr<segment> dead;
+    {
+      std::unique_lock<spinlock> l(lock);
+      auto it = std::find_if(segments.begin(), segments.end(),
+                             [s](auto &&other) { return other.get() == s; });
+      assert(it != segments.end());
+      dead = std::move(*it);
+      segments.erase(it);
+    }
+    /* returns the memory to SuperHeap outside of the lock */
+  }
+
+public:
+  template <typename... Args>
+  log_store(Args &&... args)
+      : superHeap(std::forward<Args>(args)...) {}
+  log_store(const log_store &) = delete;
+  log_store(log_store &&) = delete;
+
+  /* Room for a pair of size bytes, the first key_size of which are the key.
+   * The caller fills it in before it hands the pair out.
+   */
+  rdma_ptr<unsigned char> append(const size_t size, const size_t key_size) {
+    assert(size < Dead);
+    const size_t bytes = footprint(size);
+    segment *s;
+    segment *sealed = nullptr;
+    char *p;
+    {
+      std::unique_lock<spinlock> l(lock);
+      if (bytes > segmentSize) {
+        s = add_segment(bytes);
+        sealed = s;
+      } else {
+        if (open == nullptr || open->size - open->head < bytes) {
+          sealed = open;
+          open = add_segment(segmentSize);
+        }
+        s = open;
+      }
+      p = s->base() + s->head;
+      s->head += bytes;
+      s->live.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    if (sealed)
+      release(sealed, 1);
+
+    record *r = new (p) record;
+    r->size.store(static_cast<uint32_t>(size), std::memory_order_relaxed);
+    r->key_size = static_cast<uint32_t>(key_size);
+    /* this and s keep the deleter within the small buffer of std::function */
+    auto deleter = [this, s](unsigned char *p) {
+      record *r = reinterpret_cast<record *>(p) - 1;
+      const uint32_t size = r->size.fetch_or(Dead, std::memory_order_relaxed);
+      release(s, footprint(size));
+    };
+    return rdma_ptr<unsigned char>(
+        pointer_t<unsigned char>(reinterpret_cast<unsigned char *>(r + 1),
+                                 deleter),
+        s->mem.second);
+  }
+
+  /* Compacts up to max_segments segments which are at most utilization full
+   * and returns the number of bytes moved. Pairs freed meanwhile are skipped,
+   * or copied in vain if they have only been retired yet.
+   */
+  size_t clean(const relocate_t &relocate, const double utilization = 0.5,
+               const size_t max_segments = 4) {
+    std::vector<segment *> victims;
+    {
+      std::unique_lock<spinlock> l(lock);
+      for (auto &&s : segments) {
+        if (victims.size() == max_segments)
+          break;
+        if (s.get() == open || s->cleaning ||
+            s->live.load(std::memory_order_relaxed) > utilization * s->size)
+          continue;
+        s->cleaning = true;
+        s->live.fetch_add(1, std::memory_order_relaxed);
+        victims.push_back(s.get());
+      }
+    }
+
+    size_t moved = 0;
+    for (segment *s : victims) {
+      /* sealed, so head does not change anymore */
+      for (size_t offset = 0; offset < s->head;) {
+        record *r = reinterpret_cast<record *>(s->base() + offset);
+        const uint32_t size = r->size.load(std::memory_order_acquire);
+        offset += footprint(size & ~Dead);
+        if (size & Dead)
+          continue;
+        const unsigned char *kv = reinterpret_cast<unsigned char *>(r + 1);
+        auto copy = append(size, r->key_size);
+        memcpy(copy.first.get(), kv, size);
+        if (relocate(kv, r->key_size, copy))
+          moved += size;
+      }
+      {
+        /* pairs which could not be moved yet are retried by the next pass */
+        std::unique_lock<spinlock> l(lock);
+        s->cleaning = false;
+      }
+      release(s, 1);
+    }
+    return moved;
+  }
+
+  /* Garbage in segments counts as free, the tail of the head as unused. */
+  void stats(hydra::heap_stats &s) {
+    {
+      std::unique_lock<spinlock> l(lock);
+      for (auto &&segment : segments) {
+        /* without the references, which are below the record alignment */
+        const size_t live = segment->live.load(std::memory_order_relaxed) &
+                            ~(alignof(record) - 1);
+        s.allocated += live;
+        s.free_bytes += segment->head - live;
+        s.unused += segment->size - segment->head;
+      }
+    }
+    superHeap.stats(s);
+  }
+};
+}
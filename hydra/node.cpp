@@ -17,23 +17,70 @@
 
 namespace hydra {
 
+/* Bound to the NUMA node of the RDMA device and faulted in at startup, so that
+ * neither placement nor page faults depend on the first request.
+ */
+rdma_pool_config node::node_pool_config() {
+  rdma_pool_config config;
+  config.numa_node = rdma_pool_config::device_node;
+  return config;
+}
+
+static std::shared_ptr<rdma_arena> make_pool(const RDMAServerSocket &socket,
+                                             rdma_pool_config config,
+                                             const size_t initial_size) {
+#if RDMA_ARENA
+  if (config.numa_node == rdma_pool_config::device_node)
+    config.numa_node = socket.numa_node();
+  const size_t table_size =
+      initial_size * sizeof(LocalRDMAObj<hash_table_entry>);
+  config.reserve = std::max(config.reserve, table_size);
+  log_info() << "Registered memory pool: NUMA node " << config.numa_node
+             << ", huge pages " << config.huge_pages << ", prefault "
+             << config.prefault << ", reserving " << (config.reserve >> 20)
+             << " MiB";
+  /* the arena the READ heaps of socket use */
+  return rdma_arena::get(&socket, ibv_access::READ,
+                         [&socket](void *ptr, size_t size) {
+                           return register_memory(socket, ibv_access::READ,
+                                                  ptr, size);
+                         },
+                         config);
+#else
+  /* every allocation is mapped and registered by RdmaHeap itself */
+  static_cast<void>(socket);
+  static_cast<void>(config);
+  static_cast<void>(initial_size);
+  return nullptr;
+#endif
+}
+
 node::node(std::vector<std::string> ips, const std::string &port,
-           size_t initial_size, uint32_t msg_buffers)
-    : socket(ips, port, msg_buffers), heap(48U, default_size_classes, socket),
+           size_t initial_size, uint32_t msg_buffers, size_t workers,
+           rdma_pool_config pool_config)
+    : socket(ips, port, msg_buffers, 131071, workers),
+      pool(make_pool(socket, pool_config, initial_size)), heap(socket),
       local_heap(socket),
+#if LOG_STRUCTURED_VALUES
+      values(socket),
+#endif
       table_ptr(heap.malloc<LocalRDMAObj<hash_table_entry> >(initial_size)),
+      old_table_ptr(), draining(false),
 #if 1
       dht(std::make_unique<hopscotch_server>(table_ptr.first.get(), 32U,
                                              initial_size)),
 #else
       dht(std::make_unique<cuckoo_server>(table_ptr.first.get(), initial_size)),
 #endif
-      request_buffers(msg_buffers),
+      request_buffers(msg_buffers * workers),
       buffers_mr(socket.register_memory(
           ibv_access::REMOTE_READ | ibv_access::LOCAL_WRITE, request_buffers)),
       info(heap.malloc<LocalRDMAObj<node_info> >()),
       routing_table(std::make_unique<hydra::overlay::fixed::routing_table>(
           socket, ips[0], port, 1)),
+#if LOG_STRUCTURED_VALUES
+      stop_cleaner(false),
+#endif
       ip(ips[0]), port(port), ack(ack_message(true)), nack(ack_message(false)) {
   for (const auto &request_buffer : request_buffers) {
     post_recv(request_buffer);
@@ -41,12 +88,14 @@ node::node(std::vector<std::string> ips, const std::string &port,
 
   info([&](auto &rdma_obj) {
     (*rdma_obj.first)([&](auto &info) {
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
       info.table_size = dht->size();
 #else
       info.table_size = dht([](auto &table) { return table->size(); });
 #endif
       info.key_extents = *table_ptr.second;
+      info.old_table_size = 0;
+      info.old_key_extents = ibv_mr();
       info.id = keyspace_t(
           hash((ips.front() + port).c_str(), ips.front().size() + port.size()));
 
@@ -59,44 +108,105 @@ node::node(std::vector<std::string> ips, const std::string &port,
   socket.listen();
   //socket.accept();
 //  hydra::client test(ip, port);
+#if LOG_STRUCTURED_VALUES
+  cleaner = std::thread(&node::clean_values, this);
+#endif
+}
+
+node::~node() {
+#if LOG_STRUCTURED_VALUES
+  stop_cleaner = true;
+  cleaner.join();
+#endif
 }
 
+rdma_ptr<unsigned char> node::allocate(const size_t size,
+                                       const size_t key_size) const {
+#if LOG_STRUCTURED_VALUES
+  return values.append(size, key_size);
+#else
+  static_cast<void>(key_size);
+  return heap.malloc<unsigned char>(size);
+#endif
+}
+
+/* Compacts the value log in the background. Key/values which the cleaner
+ * moves are retired like overwritten ones, so remote readers which still use
+ * the old location verify it as before.
+ */
+void node::clean_values() {
+#if LOG_STRUCTURED_VALUES
+  auto relocate = [this](const unsigned char *from, const size_t key_size,
+                         rdma_ptr<unsigned char> &copy) {
+    server_dht::key_type key(from, key_size);
+#if STRIPED_LOCKS
+    return dht->relocate(key, copy.first, copy.second->rkey);
+#else
+    return dht([&](std::unique_ptr<server_dht> &s) {
+      return s->relocate(key, copy.first, copy.second->rkey);
+    });
+#endif
+  };
+
+  while (!stop_cleaner) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const size_t moved = values.clean(relocate);
+    if (moved)
+      log_debug() << "Cleaner moved " << moved << " bytes";
+  }
+#endif
+}
+
+/* Buffers are assigned to the workers round robin. The request is handled on
+ * the thread of the worker which received it.
+ */
 void node::post_recv(const request_t &request) {
-  socket.recv_async(request, buffers_mr.get()).then([this, &request](auto &&qp) {
-    try {
-      recv(request, qp.value());
-    }
-    catch (std::exception &e) {
-      std::cout << e.what() << std::endl;
-    }
-    catch (...) {
-      std::cout << "caught unknown thingy." << std::endl;
-      std::terminate();
-    }
-    post_recv(request);
-  });
+  const auto index = &request - request_buffers.data();
+  const size_t worker = static_cast<size_t>(index) % socket.worker_count();
+  socket.srq_recv_async(worker, request, buffers_mr.get())
+      .then([this, &request](auto &&qp) {
+        try {
+          recv(request, qp.value());
+        }
+        catch (std::exception &e) {
+          std::cout << e.what() << std::endl;
+        }
+        catch (...) {
+          std::cout << "caught unknown thingy." << std::endl;
+          std::terminate();
+        }
+        post_recv(request);
+      });
 }
 
 void node::recv(const request_t &request, const qp_t &qp) {
+  if (protocol::binary::is_binary(std::begin(request))) {
+    recv(*reinterpret_cast<const protocol::binary::header *>(
+             std::begin(request)),
+         qp);
+    return;
+  }
+
   auto message = capnp::FlatArrayMessageReader(request);
   auto dht_request = message.getRoot<protocol::DHTRequest>();
+  const uint64_t id = dht_request.getId();
 
   switch (dht_request.which()) {
   case protocol::DHTRequest::PUT: {
     auto put = dht_request.getPut();
     if (put.isRemote()) {
-      handle_add(put.getRemote(), qp);
+      handle_add(put.getRemote(), qp, id);
     } else {
-      handle_add(put.getInline(), qp);
+      handle_add(put.getInline(), qp, id);
     }
 
   } break;
   case protocol::DHTRequest::DEL: {
     auto del = dht_request.getDel();
     if (del.isRemote()) {
-      handle_del(del.getRemote(), qp);
+      handle_del(del.getRemote(), qp, id);
     } else {
-      handle_del(del.getInline(), qp);
+      handle_del(del.getInline(), qp, id);
     }
   } break;
   case protocol::DHTRequest::INIT: {
@@ -105,7 +215,9 @@ void node::recv(const request_t &request, const qp_t &qp) {
         response.initRoot<hydra::protocol::DHTResponse>();
 
     info([&](const auto &info) {
-      auto mr = msg.initInit().initInfo();
+      auto init = msg.initInit();
+      init.setBinary(true);
+      auto mr = init.initInfo();
       mr.setAddr(reinterpret_cast<uintptr_t>(info.second->addr));
       mr.setSize(static_cast<uint32_t>(info.second->length));
       mr.setRkey(info.second->rkey);
@@ -118,6 +230,38 @@ void node::recv(const request_t &request, const qp_t &qp) {
   }
 }
 
+/* The payload is used in place: the request buffer is not reposted before
+ * this returns. Sizes are 8 bits wide, so the payload cannot reach past the
+ * buffer, but the key has to lie within it.
+ */
+void node::recv(const protocol::binary::header &request, const qp_t &qp) {
+  using namespace protocol::binary;
+  static_assert(max_size <= sizeof(request_t), "Request buffers too small");
+  const unsigned char *data = payload(request);
+  bool success = false;
+
+  switch (request.op) {
+  case opcode::put: {
+    if (request.key_size > request.size) {
+      log_err() << "Key of " << unsigned(request.key_size)
+                << " bytes exceeds key/value of " << unsigned(request.size);
+      break;
+    }
+    auto mem = allocate(request.size, request.key_size);
+    memcpy(mem.first.get(), data, request.size);
+    success = handle_add(std::move(mem), request.size, request.key_size);
+  } break;
+  case opcode::del:
+    success = handle_del(data, request.size);
+    break;
+  case opcode::ack:
+    log_err() << "Unexpected ack";
+    return;
+  }
+
+  reply(qp, ack(success, request.id));
+}
+
 void node::join(const std::string &ip, const std::string &port) {
   // TODO: this should probably implemented in routing_table, since it is
   // overlay-specific.
@@ -132,23 +276,26 @@ void node::join(const std::string &ip, const std::string &port) {
 }
 
 void node::handle_add(const protocol::DHTRequest::Put::Inline::Reader &reader,
-                      const qp_t &qp) {
+                      const qp_t &qp, const uint64_t id) {
   const size_t size = reader.getSize();
-  auto mem = heap.malloc<unsigned char>(size);
+  auto mem = allocate(size, reader.getKeySize());
   memcpy(mem.first.get(), reader.getData().begin(), size);
 
   auto success = handle_add(std::move(mem), size, reader.getKeySize());
 
-  reply(qp, success ? ack : nack);
+  if (id)
+    reply(qp, ack_message(success, id));
+  else
+    reply(qp, success ? ack : nack);
 }
 
 void node::handle_add(const protocol::DHTRequest::Put::Remote::Reader &reader,
-                      const qp_t &qp) {
+                      const qp_t &qp, const uint64_t id) {
   auto kv_reader = reader.getKv();
   const size_t size = kv_reader.getSize();
   const size_t key_size = reader.getKeySize();
 
-  auto mem = heap.malloc<unsigned char>(size);
+  auto mem = allocate(size, key_size);
   auto key = mem.first.get();
   auto mr = mem.second;
 
@@ -167,7 +314,7 @@ void node::handle_add(const protocol::DHTRequest::Put::Remote::Reader &reader,
       }
     } else {
       auto success = handle_add(std::move(mem), size, key_size);
-      reply(qp, ack_message(success));
+      reply(qp, ack_message(success, id));
     }
   });
 }
@@ -179,72 +326,184 @@ bool node::handle_add(rdma_ptr<unsigned char> kv, const size_t size,
     log_err() << "Not responsible for key " << hash(kv.first.get(), key_size);
     return false;
   }
-#if PER_ENTRY_LOCKS
-  server_dht &hs = *dht;
+#if STRIPED_LOCKS
+  auto e =
+      std::make_tuple(std::move(kv.first), size, key_size, kv.second->rkey);
+
+  for (;;) {
+    const size_t rehashes = dht->rehashes();
+    auto ret = dht->add(e);
+    if (ret != hydra::NEED_RESIZE) {
+      retire(*dht);
+      prepare_next(*dht);
+      return ret == hydra::SUCCESS;
+    }
+    if (!grow(*dht, rehashes))
+      return false;
+  }
 #else
   return dht([ =, kv = std::move(kv) ](std::unique_ptr<server_dht> & hs) mutable {
+    auto e =
+        std::make_tuple(std::move(kv.first), size, key_size, kv.second->rkey);
+
+    //hs->check_consistency();
+    auto ret = hs->add(e);
+    //hs->check_consistency();
+    if (ret == hydra::NEED_RESIZE) {
+      //hs->dump();
+      std::cout << "key: " << std::get<0>(e).get();
+      if (!grow(*hs, hs->rehashes()))
+        return false;
+      //std::terminate();
+      ret = hs->add(e);
+      hs->check_consistency();
+      assert(ret != hydra::NEED_RESIZE);
+      return ret == hydra::SUCCESS;
+#if 0
+      notification_resize m(table_ptr.second);
+      notify_all(m).get();
+#endif
+    }
+    retire(*hs);
+    prepare_next(*hs);
+    return ret == hydra::SUCCESS;
+  });
 #endif
+}
 
-  auto e =
-      std::make_tuple(std::move(kv.first), size, key_size, kv.second->rkey);
+/* Starts setting up the table of the next resize, unless that has been done
+ * already or the table is not yet PrepareLoad full.
+ */
+void node::prepare_next(server_dht &hs) {
+  if (hs.load_factor() < PrepareLoad ||
+      preparing.test_and_set(std::memory_order_acquire))
+    return;
+  info([&](auto &) {
+    if (next_table.valid())
+      return;
+    /* a resize has come in between */
+    if (hs.load_factor() < PrepareLoad) {
+      preparing.clear(std::memory_order_release);
+      return;
+    }
+    const size_t size = hs.next_size();
+    next_table = std::async(std::launch::async, [this, &hs, size]() {
+      auto table = heap.malloc<LocalRDMAObj<hash_table_entry> >(size);
+      hs.prepare(table.first.get(), size);
+      return std::make_pair(size, std::move(table));
+    });
+  });
+}
 
-  //hs->check_consistency();
-  auto ret = hs->add(e);
-  //hs->check_consistency();
-  if (ret == hydra::NEED_RESIZE) {
-    //hs->dump();
-    std::cout << "key: " << std::get<0>(e).get();
-    info([&](auto &rdma_obj) {
-      size_t new_size = hs->next_size();
+/* rehashes is the number of rehashes the caller observed before its add()
+ * failed. If another thread grew the table in the meantime, there is nothing
+ * left to do. Returns false if the table could not be grown.
+ * node_info advertises two tables, so a previous resize is finished first.
+ * The new table is advertised before resize() lets anything into it, so
+ * readers looking in the old table first and the new table then do not miss
+ * entries while they move. The current table stays registered and advertised
+ * as the old table until retire() finds it drained.
+ */
+bool node::grow(server_dht &hs, const size_t rehashes) {
+  return info([&](auto &rdma_obj) {
+    if (hs.rehashes() != rehashes)
+      return true;
+    if (!hs.drain())
+      log_err() << "Old table did not fit, readers may miss its rest until "
+                   "the resize has finished";
+
+    const size_t new_size = hs.next_size();
+    decltype(table_ptr) new_table;
+    if (next_table.valid()) {
+      auto next = next_table.get();
+      if (next.first == new_size)
+        new_table = std::move(next.second);
+    }
+    if (!new_table.first) {
       log_info() << "Allocating " << new_size
                  << " entries: " << new_size * sizeof(hash_table_entry);
-      auto new_table = heap.malloc<LocalRDMAObj<hash_table_entry> >(new_size);
-      hs->resize(new_table.first.get(), new_size);
-      hs->check_consistency();
-      (*rdma_obj.first)([&](auto &info) {
-        info.table_size = new_size;
-        info.key_extents = *new_table.second;
-      });
-      std::swap(table_ptr, new_table);
+      new_table = heap.malloc<LocalRDMAObj<hash_table_entry> >(new_size);
+      hs.prepare(new_table.first.get(), new_size);
+    }
+
+    const size_t old_size = hs.size();
+    const auto advertised = rdma_obj.first->get();
+    (*rdma_obj.first)([&](auto &info) {
+      info.table_size = new_size;
+      info.key_extents = *new_table.second;
+      info.old_table_size = old_size;
+      info.old_key_extents = *table_ptr.second;
     });
-    //std::terminate();
-    ret = hs->add(e);
-    hs->check_consistency();
-    assert(ret != hydra::NEED_RESIZE);
-    return ret == hydra::SUCCESS;
-#if 0
-    notification_resize m(table_ptr.second);
-    notify_all(m).get();
+    if (hs.resize(new_table.first.get(), new_size) != hydra::SUCCESS) {
+      log_err() << "Entries of the old table do not fit into " << new_size
+                << " entries, not resizing";
+      (*rdma_obj.first)([&](auto &info) { info = advertised; });
+      /* readers may have seen the new table already */
+      retired_tables.retire(std::move(new_table.first));
+      preparing.clear(std::memory_order_release);
+      return false;
+    }
+    hs.check_consistency();
+    std::swap(old_table_ptr, table_ptr);
+    retired_tables.retire(std::move(table_ptr.first));
+    table_ptr = std::move(new_table);
+    draining = true;
+    preparing.clear(std::memory_order_release);
+    return true;
+  });
+}
+
+void node::retire(const server_dht &hs) const {
+  if (retired_tables.pending())
+    retired_tables.collect();
+  if (!draining || hs.resizing())
+    return;
+  info([&](auto &rdma_obj) {
+    if (!draining || hs.resizing())
+      return;
+    (*rdma_obj.first)([&](auto &info) {
+      info.old_table_size = 0;
+      info.old_key_extents = ibv_mr();
+    });
+    retired_tables.retire(std::move(old_table_ptr.first));
+    old_table_ptr = decltype(old_table_ptr)();
+    draining = false;
+  });
+}
+
+/* The key is only compared against, so it is used where it was received. */
+bool node::handle_del(const unsigned char *key, const size_t size) const {
+#if STRIPED_LOCKS
+  server_dht::key_type key_ = std::make_pair(key, size);
+  auto ret = dht->remove(key_);
+  retire(*dht);
+#else
+  auto ret = dht([=](std::unique_ptr<server_dht> &s) {
+    server_dht::key_type key_ = std::make_pair(key, size);
+    s->check_consistency();
+    auto ret = s->remove(key_);
+    s->check_consistency();
+    retire(*s);
+    return ret;
+  });
 #endif
-  }
   return ret == hydra::SUCCESS;
-});
 }
 
 void node::handle_del(const protocol::DHTRequest::Del::Inline::Reader &reader,
-                      const qp_t &qp) const {
+                      const qp_t &qp, const uint64_t id) const {
   auto data = reader.getKey();
+  auto success = handle_del(data.begin(), reader.getSize());
 
-  auto mem = heap.malloc<unsigned char>(reader.getSize());
-  auto key = mem.first.get();
-  
-  memcpy(key, data.begin(), reader.getSize());
-
-  auto ret = dht([ =, &reader, mem = std::move(mem) ]
-      (std::unique_ptr<server_dht> & s) mutable {
-            server_dht::key_type key =
-                std::make_pair(mem.first.get(), reader.getSize());
-            s->check_consistency();
-            auto ret = s->remove(key);
-            s->check_consistency();
-            return ret;
-  });
-  reply(qp, ack_message(ret == hydra::SUCCESS));
+  if (id)
+    reply(qp, ack_message(success, id));
+  else
+    reply(qp, success ? ack : nack);
 }
 
 
 void node::handle_del(const protocol::DHTRequest::Del::Remote::Reader &reader,
-                      const qp_t &qp) const {
+                      const qp_t &qp, const uint64_t id) const {
   auto mr = reader.getKey();
   
   const size_t size = mr.getSize();
@@ -258,15 +517,22 @@ void node::handle_del(const protocol::DHTRequest::Del::Remote::Reader &reader,
                              mr.getRkey());
   }).then([ =, mem = std::move(mem) ](auto && result) mutable {
     if (result) {
+#if STRIPED_LOCKS
+      server_dht::key_type key = std::make_pair(mem.first.get(), size);
+      auto ret = dht->remove(key);
+      retire(*dht);
+#else
       auto ret = dht([ =, mem = std::move(mem) ]
           (std::unique_ptr<server_dht> & s) mutable {
         server_dht::key_type key = std::make_pair(mem.first.get(), size);
         s->check_consistency();
         auto ret = s->remove(key);
         s->check_consistency();
+        retire(*s);
         return ret;
       });
-      reply(qp, ack_message(ret == hydra::SUCCESS));
+#endif
+      reply(qp, ack_message(ret == hydra::SUCCESS, id));
     }
   });
 }
@@ -293,8 +559,13 @@ void node::reply(const qp_t &qp,
   });
 }
 
+void node::reply(const qp_t &qp,
+                 const protocol::binary::header &reply) const {
+  return socket(qp, [&](rdma_cm_id *id) { sendImmediate(id, reply); });
+}
+
 double node::load() const {
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
   return dht->load_factor();
 #else
   return dht([](const auto &s) { return s->load_factor(); });
@@ -302,7 +573,7 @@ double node::load() const {
 }
 
 size_t node::size() const {
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
   return dht->size();
 #else
   return dht([](const auto &s) { return s->size(); });
@@ -310,15 +581,52 @@ size_t node::size() const {
 }
 
 size_t node::used() const {
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
   return dht->used();
 #else
   return dht([](const auto &s) { return s->used(); });
 #endif
 }
 
+memory_report node::memory() const {
+  memory_report report;
+  heap.stats(report.heap);
+#if LOG_STRUCTURED_VALUES
+  values.stats(report.heap);
+#endif
+  local_heap.stats(report.local_heap);
+  info([&](auto &rdma_obj) {
+    (*rdma_obj.first)([&](auto &info) {
+      report.table_bytes =
+          info.table_size * sizeof(LocalRDMAObj<hash_table_entry>);
+      report.old_table_bytes =
+          info.old_table_size * sizeof(LocalRDMAObj<hash_table_entry>);
+    });
+  });
+  report.retired_tables = retired_tables.pending();
+#if STRIPED_LOCKS
+  report.retired_entries = dht->pending_reclamation();
+  report.entries = dht->used();
+#else
+  std::tie(report.retired_entries, report.entries) = dht([](const auto &s) {
+    return std::make_pair(s->pending_reclamation(), s->used());
+  });
+#endif
+  return report;
+}
+
+std::ostream &operator<<(std::ostream &s, const memory_report &report) {
+  return s << report.entries << " entries, table " << report.table_bytes
+           << " bytes, old table " << report.old_table_bytes << " bytes, "
+           << report.retired_tables << " table(s) and "
+           << report.retired_entries << " key/value(s) retired" << std::endl
+           << "heap: " << report.heap << std::endl
+           << "local heap: " << report.local_heap;
+}
+
 void node::dump() const {
-#if PER_ENTRY_LOCKS
+#if STRIPED_LOCKS
+  dht->dump();
 #else
   dht([](const auto &s) { s->dump(); });
 #endif
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <ostream>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -12,18 +16,48 @@
 #include "rdma/RDMAServerSocket.h"
 #include "rdma/RDMAClientSocket.h"
 #include "hydra/server_dht.h"
+#include "hydra/reclaimer.h"
+#include "hydra/log_store.h"
 #include "hydra/types.h"
 #include "hydra/chord.h"
 #include "protocol/message.h"
+#include "protocol/binary.h"
 
 #include "util/concurrent.h"
 #include "util/WorkerThread.h"
 
 #include "allocators/allocators.h"
 
+/* Append key/values to a log, which a background thread compacts, instead of
+ * allocating them by size from the heap. Keeps the footprint of nodes whose
+ * value sizes change over time from growing.
+ */
+#ifndef LOG_STRUCTURED_VALUES
+#define LOG_STRUCTURED_VALUES 0
+#endif
+
 namespace hydra {
+/* Memory held by a node, see node::memory(). */
+struct memory_report {
+  /* key/values and tables */
+  heap_stats heap;
+  /* buffers of requests served from local memory */
+  heap_stats local_heap;
+  size_t table_bytes = 0;
+  /* being drained after a resize */
+  size_t old_table_bytes = 0;
+  /* drained tables and removed key/values, which clients may still read */
+  size_t retired_tables = 0;
+  size_t retired_entries = 0;
+  size_t entries = 0;
+};
+
+std::ostream &operator<<(std::ostream &s, const memory_report &report);
+
 class node {
   RDMAServerSocket socket;
+  /* registered memory of heap, set up before the first allocation */
+  std::shared_ptr<rdma_arena> pool;
 
 #if 1
   mutable default_heap_t heap;
@@ -32,12 +66,30 @@ class node {
 #endif
   mutable ThreadSafeHeap<ZoneHeap<RdmaHeap<ibv_access::MSG>, 1024 * 1024 * 16> >
   local_heap;
+#if LOG_STRUCTURED_VALUES
+  /* outlives dht, which holds its key/values */
+  mutable log_store<RdmaHeap<ibv_access::READ>, 64 * 1024 * 1024> values;
+#endif
   decltype(heap.malloc<LocalRDMAObj<hash_table_entry> >()) table_ptr;
-#if PER_ENTRY_LOCKS
+  /* kept alive until the DHT has drained it after a resize */
+  mutable decltype(heap.malloc<LocalRDMAObj<hash_table_entry> >())
+  old_table_ptr;
+  /* drained tables, which clients may still be reading */
+  mutable epoch_reclaimer<decltype(old_table_ptr.first)> retired_tables;
+  mutable std::atomic_bool draining;
+#if STRIPED_LOCKS
   std::unique_ptr<server_dht> dht;
 #else
   monitor<std::unique_ptr<server_dht>> dht;
 #endif
+  /* The table of the next resize, allocated and set up in the background once
+   * the table is PrepareLoad full, so the add growing the table does not have
+   * to. Set up from dht, which it thus follows. preparing is set from the
+   * start of a preparation until grow() takes the table.
+   */
+  static constexpr double PrepareLoad = 0.5;
+  std::future<std::pair<size_t, decltype(table_ptr)> > next_table;
+  std::atomic_flag preparing = ATOMIC_FLAG_INIT;
 
   using request_t = kj::FixedArray<capnp::word, 128>;
   std::vector<request_t> request_buffers;
@@ -45,6 +97,10 @@ class node {
 
   monitor<decltype(heap.malloc<LocalRDMAObj<node_info>>())> info;
   std::unique_ptr<hydra::overlay::routing_table> routing_table;
+#if LOG_STRUCTURED_VALUES
+  std::atomic_bool stop_cleaner;
+  std::thread cleaner;
+#endif
 
   std::string ip;
   std::string port;
@@ -57,28 +113,45 @@ class node {
 
   void post_recv(const request_t &);
   void recv(const request_t &, const qp_t &qp);
+  void recv(const protocol::binary::header &request, const qp_t &qp);
   void send(const uint64_t id);
   void reply(const qp_t &qp, ::capnp::MessageBuilder &reply) const;
   void reply(const qp_t &qp, const ::kj::Array< ::capnp::word> &reply) const;
+  void reply(const qp_t &qp, const protocol::binary::header &reply) const;
 
+  rdma_ptr<unsigned char> allocate(const size_t size,
+                                   const size_t key_size) const;
+  void clean_values();
   bool handle_add(rdma_ptr<unsigned char> kv, const size_t size,
                   const size_t key_size);
+  void prepare_next(server_dht &hs);
+  bool grow(server_dht &hs, const size_t rehashes);
+  void retire(const server_dht &hs) const;
+  bool handle_del(const unsigned char *key, const size_t size) const;
   void handle_add(const protocol::DHTRequest::Put::Inline::Reader &reader,
-                  const qp_t &qp);
+                  const qp_t &qp, const uint64_t id);
   void handle_add(const protocol::DHTRequest::Put::Remote::Reader &reader,
-                  const qp_t &);
+                  const qp_t &, const uint64_t id);
   void handle_del(const protocol::DHTRequest::Del::Remote::Reader &reader,
-                  const qp_t &qp) const;
+                  const qp_t &qp, const uint64_t id) const;
   void handle_del(const protocol::DHTRequest::Del::Inline::Reader &reader,
-                  const qp_t &qp) const;
+                  const qp_t &qp, const uint64_t id) const;
 
 public:
+  /* msg_buffers receive buffers are posted for each of the workers. The pool
+   * always reserves room for the initial table.
+   */
   node(std::vector<std::string> ips, const std::string &port,
-       size_t initial_size = 1024 * 1024, uint32_t msg_buffers = 1024);
+       size_t initial_size = 1024 * 1024, uint32_t msg_buffers = 1024,
+       size_t workers = 1, rdma_pool_config pool_config = node_pool_config());
+  ~node();
+  static rdma_pool_config node_pool_config();
   void join(const std::string& ip, const std::string& port);
   double load() const;
   size_t size() const;
   size_t used() const;
+  /* Walks the heaps, which stall allocations meanwhile. */
+  memory_report memory() const;
   void dump() const;
 };
 
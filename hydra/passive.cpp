@@ -1,137 +1,714 @@
 #include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include "hash.h"
 #include "passive.h"
 #include "util/Logger.h"
 
-auto size2Class = [](size_t size) -> size_t {
-  if (size == 0)
-    return 0;
-  if (size <= 128) // 16 bins
-    return ((size + (8 - 1)) & ~(8 - 1)) / 8 - 1;
-  else if (size <= 4096) // 31 bins
-    return ((size + (128 - 1)) & ~(128 - 1)) / 128 + 14;
-  else
-    return 47 + hydra::util::log2(size - 1) -
-           hydra::util::static_log2<4096>::value;
-};
-
-hydra::passive::passive(const std::string &host, const std::string &port)
-    : RDMAClientSocket(host, port), buffer(std::make_unique<buffer_t>()),
-      buffer_mr(register_memory(ibv_access::MSG, *buffer)),
-      heap(48U, size2Class, *this), info(std::make_unique<hydra::node_info>()),
+hydra::passive::passive(const std::string &host, const std::string &port,
+                        const size_t depth)
+    : RDMAClientSocket(host, port), heap(*this), staging(*this),
+      info(std::make_unique<hydra::node_info>()),
       info_mr(register_memory(ibv_access::MSG, *info)),
       response(std::make_unique<response_t>()),
-      response_mr(register_memory(ibv_access::MSG, *response)) {
+      response_mr(register_memory(ibv_access::MSG, *response)),
+      buffers(depth), buffers_mr(register_memory(ibv_access::MSG, buffers)),
+      slots(depth), batch(depth),
+      batch_mr(register_memory(ibv_access::MSG, batch)), responses(depth),
+      responses_mr(register_memory(ibv_access::MSG, responses)) {
   log_info() << "Starting client to " << host << ":" << port;
 
   connect();
   update_info();
+
+  /* init() is done with response, so the ring can take over the SRQ. */
+  for (const auto &response : responses)
+    post_recv(response);
 }
 
-bool hydra::passive::put(const std::vector<unsigned char> &kv,
-                         const size_t &key_size) {
+/* The id of a request is only ever reused after its ack was received, so acks
+ * map to slots unambiguously. Ids of busy slots are skipped.
+ */
+bool hydra::passive::try_acquire(size_t &index) {
+  for (size_t i = 0; i < slots.size(); i++) {
+    const uint64_t id = next_id++;
+    index = id % slots.size();
+    bool expected = false;
+    /* sequentially consistent, see release() */
+    if (slots[index].busy.compare_exchange_strong(expected, true)) {
+      slots[index].id = id;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Runs request with a slot, right away if one has been freed in the meantime.
+ * Otherwise it is queued and run by release(), possibly on the completion
+ * thread.
+ */
+void hydra::passive::wait(std::function<void(const size_t)> request) {
+  size_t index;
+  {
+    std::unique_lock<std::mutex> l(waiting_mutex);
+    n_waiting.fetch_add(1);
+    if (!try_acquire(index)) {
+      waiting.push_back(std::move(request));
+      return;
+    }
+    n_waiting.fetch_sub(1);
+  }
+  request(index);
+}
+
+void hydra::passive::resume() {
+  std::unique_lock<std::mutex> l(waiting_mutex);
+  size_t index;
+  while (!waiting.empty() && try_acquire(index)) {
+    auto request = std::move(waiting.front());
+    waiting.pop_front();
+    n_waiting.fetch_sub(1);
+    l.unlock();
+    request(index);
+    l.lock();
+  }
+}
+
+/* Either wait() sees the slot free, or the slot is freed after n_waiting was
+ * raised and the waiting requests are resumed here.
+ */
+void hydra::passive::release(const size_t index) {
+  slots[index].busy.store(false);
+  if (n_waiting.load() != 0)
+    resume();
+}
+
+hydra::future<bool> hydra::passive::prepare(const size_t index) {
+  auto &slot = slots[index];
+  slot.ack = new hydra::promise<bool>();
+  return slot.ack->get_future();
+}
+
+/* Undo prepare() for a request that could not be sent. */
+void hydra::passive::abort(const size_t index) {
+  auto &slot = slots[index];
+  delete slot.ack;
+  slot.ack = nullptr;
+  slot.kv = decltype(slot.kv)();
+  release(index);
+}
+
+/* Builds the request with build and sends it from slot index. Errors are
+ * reported through ack.
+ */
+template <typename F>
+void hydra::passive::send_request(const size_t index,
+                                  hydra::promise<bool> *ack, F &&build) {
+  slots[index].ack = ack;
+  try {
+    build(index);
+    send(std::begin(buffers[index].request), slots[index].length,
+         buffers_mr.get());
+  }
+  catch (...) {
+    ack->set_exception(std::current_exception());
+    abort(index);
+  }
+}
+
+template <typename F>
+hydra::future<bool> hydra::passive::submit(const size_t index, F &&build) {
+  auto ack = new hydra::promise<bool>();
+  auto future = ack->get_future();
+  send_request(index, ack, std::forward<F>(build));
+  return future;
+}
+
+/* For requests without a free slot; build must not refer to the caller. */
+hydra::future<bool>
+hydra::passive::enqueue(std::function<void(const size_t)> build) {
+  auto ack = new hydra::promise<bool>();
+  auto future = ack->get_future();
+  wait([this, ack, build](const size_t index) {
+    send_request(index, ack, build);
+  });
+  return future;
+}
+
+/* buffer_t holds inline requests with room to spare; a message which does
+ * not fit is a bug and must not be sent truncated.
+ */
+void hydra::passive::encode(const size_t index,
+                            const kj::Array<capnp::word> &message) {
   using namespace hydra::rdma;
-  auto future = recv_async(*response, response_mr.get());
+  auto &request = buffers[index].request;
+  const size_t size = size_of(message);
+  if (size > request.size() * sizeof(capnp::word)) {
+    std::ostringstream ss;
+    ss << "Request of " << size << " bytes exceeds its buffer";
+    throw std::runtime_error(ss.str());
+  }
+  slots[index].length = size;
+  memcpy(std::begin(request), std::begin(message), size);
+}
+
+/* Inline requests use the fixed-layout messages if the node supports them. */
+void hydra::passive::put_request(const size_t index,
+                                 const std::vector<unsigned char> &kv,
+                                 const size_t &key_size) {
+  auto &slot = slots[index];
+
+  if (kv.size() < InlineSize) {
+    if (binary) {
+      slot.length = protocol::binary::put(std::begin(buffers[index].request),
+                                          kv.data(), kv.size(), key_size,
+                                          slot.id);
+    } else {
+      encode(index, put_message_inline(kv, key_size, slot.id));
+    }
+    return;
+  }
+
+  /* The server reads the key/value pair; it is recycled with the ack. */
+  slot.kv = staging.malloc<unsigned char>(kv.size());
+  memcpy(slot.kv.first.get(), kv.data(), kv.size());
+  encode(index, put_message(slot.kv, kv.size(), key_size, slot.id));
+}
 
-  if (kv.size() < 256) {
-    auto put = put_message_inline(kv, key_size);
-    memcpy(std::begin(*buffer), std::begin(put),
-           std::min(buffer->size() * sizeof(capnp::word), size_of(put)));
-    send(*buffer, buffer_mr.get());
+void hydra::passive::del_request(const size_t index,
+                                 const std::vector<unsigned char> &key) {
+  auto &slot = slots[index];
 
-    future.get();
-  } else {
-    auto kv_mr = heap.malloc<unsigned char>(kv.size());
-    memcpy(kv_mr.first.get(), kv.data(), kv.size());
+  if (key.size() < InlineSize) {
+    if (binary) {
+      slot.length = protocol::binary::del(std::begin(buffers[index].request),
+                                          key.data(), key.size(), slot.id);
+    } else {
+      encode(index, del_message_inline(key, slot.id));
+    }
+    return;
+  }
+
+  slot.kv = heap.malloc<unsigned char>(key.size());
+  memcpy(slot.kv.first.get(), key.data(), key.size());
+  encode(index, del_message(slot.kv, key.size(), slot.id));
+}
+
+void hydra::passive::post_recv(const response_t &response) {
+  recv_async(response, responses_mr.get()).then([this, &response](
+      auto &&qp) {
+    try {
+      qp.value();
+    }
+    catch (const std::exception &e) {
+      /* flushed when the connection goes down; do not repost */
+      log_err() << e.what();
+      return;
+    }
+
+    uint64_t id;
+    bool success;
+    if (protocol::binary::is_binary(std::begin(response))) {
+      const auto &ack = *reinterpret_cast<const protocol::binary::header *>(
+          std::begin(response));
+      assert(ack.op == protocol::binary::opcode::ack);
+      id = ack.id;
+      success = ack.success;
+    } else {
+      auto message = capnp::FlatArrayMessageReader(response);
+      auto reader = message.getRoot<hydra::protocol::DHTResponse>();
+      assert(reader.which() == hydra::protocol::DHTResponse::ACK);
+      id = reader.getId();
+      success = reader.getAck().getSuccess();
+    }
+
+    /* Repost before the slot is released, so that there is a receive for
+     * every request in flight.
+     */
+    post_recv(response);
+    complete(id, success);
+  });
+}
+
+void hydra::passive::complete(const uint64_t id, const bool success) {
+  const size_t index = id % slots.size();
+  auto &slot = slots[index];
+  assert(slot.id == id);
 
-    auto put = put_message(kv_mr, kv.size(), key_size);
-    memcpy(std::begin(*buffer), std::begin(put),
-           std::min(buffer->size() * sizeof(capnp::word), size_of(put)));
-    send(*buffer, buffer_mr.get());
+  auto ack = slot.ack;
+  slot.ack = nullptr;
+  slot.kv = decltype(slot.kv)();
+  release(index);
+
+  ack->set_value(success);
+  delete ack;
+}
+
+/* The key/value is only copied if the request has to wait for a slot. */
+hydra::future<bool>
+hydra::passive::put_async(const std::vector<unsigned char> &kv,
+                          const size_t &key_size) {
+  size_t index;
+  if (!try_acquire(index)) {
+    return enqueue([this, kv, key_size](const size_t index) {
+      put_request(index, kv, key_size);
+    });
+  }
+  return submit(index, [&](const size_t index) {
+    put_request(index, kv, key_size);
+  });
+}
 
-    future.get(); // stay in scope for kv_mr
+hydra::future<bool>
+hydra::passive::remove_async(const std::vector<unsigned char> &key) {
+  size_t index;
+  if (!try_acquire(index)) {
+    return enqueue(
+        [this, key](const size_t index) { del_request(index, key); });
   }
+  return submit(index,
+                [&](const size_t index) { del_request(index, key); });
+}
+
+hydra::passive::registered_buffer
+hydra::passive::register_buffer(unsigned char *data, const size_t size) {
+  return { data, size, register_memory(ibv_access::READ, data, size) };
+}
 
-  auto message = capnp::FlatArrayMessageReader(*response);
-  auto reader = message.getRoot<hydra::protocol::DHTResponse>();
-  assert(reader.which() == hydra::protocol::DHTResponse::ACK);
-  return reader.getAck().getSuccess();
+/* Like put_request(), minus the copy. */
+hydra::future<bool>
+hydra::passive::put_registered(const registered_buffer &buffer,
+                               const size_t offset, const size_t size,
+                               const size_t key_size) {
+  assert(offset + size <= buffer.size);
+  auto build = [ this, data = buffer.data + offset, size, key_size,
+                 rkey = buffer.mr->rkey ](const size_t index) {
+    encode(index, put_message(data, size, key_size, rkey, slots[index].id));
+  };
+  size_t index;
+  if (!try_acquire(index))
+    return enqueue(build);
+  return submit(index, build);
+}
+
+bool hydra::passive::put(const std::vector<unsigned char> &kv,
+                         const size_t &key_size) {
+  return put_async(kv, key_size).get().value();
 }
 
 bool hydra::passive::remove(const std::vector<unsigned char> &key) {
-  using namespace hydra::rdma;
-  auto future = recv_async(*response, response_mr.get());
+  return remove_async(key).get().value();
+}
+
+/* Only the home entry and the entries it points to have to be consistent;
+ * the neighbourhood is re-read if one of them was torn by a concurrent update.
+ */
+static bool consistent(const RDMAObj<hydra::hash_table_entry> *entries,
+                       const size_t n) {
+  if (!entries[0].valid())
+    return false;
+  const auto hop = entries[0].get().hop;
+  for (size_t d = 0; d < n; d++) {
+    if ((hop & (1U << d)) && !entries[d].valid())
+      return false;
+  }
+  return true;
+}
 
-  if (key.size() < 256) {
-    auto del = del_message_inline(key);
-    memcpy(std::begin(*buffer), std::begin(del),
-           std::min(buffer->size() * sizeof(capnp::word), size_of(del)));
-    send(*buffer, buffer_mr.get());
+/* A lookup in flight. It owns a slot for the neighbourhood and walks the
+ * tables to search, the one being drained by a resize first.
+ */
+struct hydra::passive::lookup {
+  std::vector<unsigned char> key;
+  uint64_t hash = 0;
+  hydra::promise<std::vector<unsigned char> > promise;
+  size_t slot = 0;
+  std::array<std::pair<ibv_mr, uint64_t>, 2> tables;
+  size_t n_tables = 0;
+  size_t table = 0;
+  size_t n = 0;
+  size_t retries = 3;
+};
 
-    future.get();
-  } else {
-    auto key_mr = heap.malloc<unsigned char>(key.size());
-    memcpy(key_mr.first.get(), key.data(), key.size());
+/* During a resize, node_info describes both the table being drained and the
+ * new one. Entries are inserted into the new table before they are removed
+ * from the old one, so looking into the old table first does not miss keys
+ * being moved.
+ */
+hydra::future<std::vector<unsigned char> >
+hydra::passive::get_async(const std::vector<unsigned char> &key) {
+  auto l = std::make_shared<lookup>();
+  auto future = l->promise.get_future();
+
+  l->key = key;
+  l->hash = hash(key);
+  size_t index;
+  if (try_acquire(index))
+    start(l, index);
+  else
+    wait([this, l](const size_t index) { start(l, index); });
+
+  return future;
+}
+
+void hydra::passive::start(std::shared_ptr<lookup> l, const size_t slot) {
+  l->slot = slot;
+  if (info->old_table_size)
+    l->tables[l->n_tables++] =
+        std::make_pair(info->old_key_extents, info->old_table_size);
+  l->tables[l->n_tables++] =
+      std::make_pair(info->key_extents, info->table_size);
+
+  try {
+    read_neighbourhood(l);
+  }
+  catch (...) {
+    fail(l, std::current_exception());
+  }
+}
 
-    auto del = del_message(key_mr, key.size());
-    memcpy(std::begin(*buffer), std::begin(del),
-           std::min(buffer->size() * sizeof(capnp::word), size_of(del)));
-    send(*buffer, buffer_mr.get());
+/* Fetch the neighbourhood with a single RDMA read, or two if it wraps around
+ * the end of the table. Reads complete in order, so the lookup continues when
+ * the last one does.
+ */
+void hydra::passive::read_neighbourhood(std::shared_ptr<lookup> l) {
+  const ibv_mr &extents = l->tables[l->table].first;
+  const size_t table_size = l->tables[l->table].second;
+  auto &entries = buffers[l->slot].entries;
+  auto table = reinterpret_cast<RDMAObj<hash_table_entry> *>(extents.addr);
+
+  l->n = std::min(entries.size(), table_size);
+  const size_t index = reduce(l->hash, table_size);
+  const size_t first = std::min(l->n, table_size - index);
+
+  auto future = read(entries.data(), buffers_mr.get(), table + index,
+                     extents.rkey, first);
+  if (first < l->n) {
+    future = read(entries.data() + first, buffers_mr.get(), table,
+                  extents.rkey, l->n - first);
+  }
+  future.then([this, l](auto &&qp) {
+    try {
+      qp.value();
+      scan(l, 0);
+    }
+    catch (...) {
+      fail(l, std::current_exception());
+    }
+  });
+}
+
+/* Scan the neighbourhood from hop distance from on. Inlined key/value pairs
+ * are taken from the neighbourhood directly, the others cost one more read
+ * per candidate. Entries with another fingerprint are not candidates.
+ * Neighbourhoods and key/values which fail validation count against retries.
+ */
+void hydra::passive::scan(std::shared_ptr<lookup> l, const size_t from) {
+  const auto &entries = buffers[l->slot].entries;
+  const auto &key = l->key;
+
+  if (from == 0 && !consistent(entries.data(), l->n)) {
+    if (--l->retries == 0)
+      throw std::runtime_error("Could not validate remote object");
+    read_neighbourhood(l);
+    return;
+  }
+
+  for (uint32_t c = candidates(entries.data(), from, l->n,
+                              fingerprint(l->hash), key.size());
+       c; c &= c - 1) {
+    const size_t d = static_cast<size_t>(__builtin_ctz(c));
+    const auto &entry = entries[d].get();
+
+#if INLINE_THRESHOLD
+    if (entry.is_inline()) {
+      if (std::equal(std::begin(key), std::end(key), entry.inline_key())) {
+        finish(l, std::vector<unsigned char>(
+                      entry.inline_value(),
+                      entry.inline_value() + entry.value_length()));
+        return;
+      }
+      continue;
+    }
+#endif
+
+    auto data = heap.malloc<unsigned char>(entry.ptr.size);
+    auto local = data.first.get();
+    auto mr = data.second;
+    read(local, mr, entry.key(), entry.rkey, entry.ptr.size)
+        .then([ this, l, d, data = std::move(data) ](auto && qp) {
+          try {
+            qp.value();
+            const auto &entry = buffers[l->slot].entries[d].get();
+            const auto p = data.first.get();
+            if (!entry.ptr.matches(p)) {
+              /* Torn, or the entry is stale and its key/value has been
+               * retired. Either way, the neighbourhood is read again.
+               */
+              if (--l->retries == 0)
+                throw std::runtime_error("Could not validate remote object");
+              read_neighbourhood(l);
+            } else if (std::equal(std::begin(l->key), std::end(l->key), p)) {
+              finish(l, std::vector<unsigned char>(
+                            p + entry.key_length(),
+                            p + entry.key_length() + entry.value_length()));
+            } else {
+              scan(l, d + 1);
+            }
+          }
+          catch (...) {
+            fail(l, std::current_exception());
+          }
+        });
+    return;
+  }
 
-    future.get(); // stay in scope for key_mr
+  if (++l->table < l->n_tables) {
+    l->retries = 3;
+    read_neighbourhood(l);
+  } else {
+    finish(l, std::vector<unsigned char>());
   }
+}
 
-  auto message = capnp::FlatArrayMessageReader(*response);
-  auto reader = message.getRoot<hydra::protocol::DHTResponse>();
-  assert(reader.which() == hydra::protocol::DHTResponse::ACK);
-  return reader.getAck().getSuccess();
+void hydra::passive::finish(const std::shared_ptr<lookup> &l,
+                            std::vector<unsigned char> value) {
+  release(l->slot);
+  l->promise.set_value(std::move(value));
 }
 
+void hydra::passive::fail(const std::shared_ptr<lookup> &l,
+                          std::exception_ptr e) {
+  release(l->slot);
+  l->promise.set_exception(e);
+}
+
+/* A miss might be due to stale node_info, so it is refreshed and the lookup
+ * is repeated if the tables changed.
+ */
 std::vector<unsigned char>
 hydra::passive::find_entry(const std::vector<unsigned char> &key) {
-  std::vector<unsigned char> value;
+  for (;;) {
+    const uint64_t table_size = info->table_size;
+    const uint64_t old_table_size = info->old_table_size;
+
+    auto value = get_async(key).get().value();
+    if (!value.empty())
+      return value;
+
+    update_info();
+    if (info->table_size == table_size &&
+        info->old_table_size == old_table_size)
+      return value;
+  }
+}
 
-  //TODO: update only, if read later fails.
-  //a failing read means that the server resized.
-  //update_info();
+/* Look up a batch of keys with two doorbells: one for the neighbourhoods of
+ * all keys and one for the key/value pairs of all candidates which are not
+ * inlined. Keys whose entries were torn and lookups during a resize take the
+ * pipelined per-key path instead.
+ */
+std::vector<std::vector<unsigned char> >
+hydra::passive::multi_get(
+    const std::vector<std::vector<unsigned char> > &keys) {
+  std::vector<std::vector<unsigned char> > values(keys.size());
+  std::vector<size_t> retry;
+
+  const uint64_t table_size = info->table_size;
+  const uint64_t old_table_size = info->old_table_size;
+
+  for (size_t begin = 0; begin < keys.size(); begin += batch.size()) {
+    get_batch(keys, values, begin, std::min(keys.size(), begin + batch.size()),
+              retry);
+  }
 
-  const size_t entry_size = sizeof(RDMAObj<hash_table_entry>);
+  std::vector<hydra::future<std::vector<unsigned char> > > futures;
+  futures.reserve(retry.size());
+  for (const auto index : retry)
+    futures.push_back(get_async(keys[index]));
+  for (size_t i = 0; i < retry.size(); i++)
+    values[retry[i]] = futures[i].get().value();
+
+  /* see find_entry() */
+  auto missing = [](const auto &value) { return value.empty(); };
+  if (std::any_of(std::begin(values), std::end(values), missing)) {
+    update_info();
+    if (info->table_size != table_size ||
+        info->old_table_size != old_table_size) {
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (values[i].empty())
+          values[i] = find_entry(keys[i]);
+      }
+    }
+  }
+
+  return values;
+}
+
+void hydra::passive::get_batch(
+    const std::vector<std::vector<unsigned char> > &keys,
+    std::vector<std::vector<unsigned char> > &values, const size_t begin,
+    const size_t end, std::vector<size_t> &retry) {
+  if (info->old_table_size) {
+    for (size_t i = begin; i < end; i++)
+      retry.push_back(i);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(batch_mutex);
+  const ibv_mr extents = info->key_extents;
   const size_t table_size = info->table_size;
-  const uintptr_t table_base =
-      reinterpret_cast<uintptr_t>(info->key_extents.addr);
-  const uint32_t rkey = info->key_extents.rkey;
+  auto table = reinterpret_cast<RDMAObj<hash_table_entry> *>(extents.addr);
+  const size_t n =
+      std::min(std::tuple_size<neighbourhood_t>::value, table_size);
+  const size_t entry_size = sizeof(RDMAObj<hash_table_entry>);
 
-  const size_t index = hash(key) % table_size;
-  // &table_base[index];
-  uintptr_t remote_index = table_base + index * entry_size;
+  std::vector<const unsigned char *> key_data;
+  std::vector<size_t> key_sizes;
+  std::vector<uint64_t> hashes(end - begin);
+  for (size_t i = begin; i < end; i++) {
+    key_data.push_back(keys[i].data());
+    key_sizes.push_back(keys[i].size());
+  }
+  key_hash::hash(key_data.data(), key_sizes.data(), end - begin,
+                 hashes.data());
+
+  wr_chain chain;
+  for (size_t i = begin; i < end; i++) {
+    auto entries = batch[i - begin].data();
+    const size_t index = reduce(hashes[i - begin], table_size);
+    const size_t first = std::min(n, table_size - index);
+
+    chain.read(entries, first * entry_size, batch_mr.get(),
+               reinterpret_cast<uintptr_t>(table + index), extents.rkey);
+    if (first < n) {
+      chain.read(entries + first, (n - first) * entry_size, batch_mr.get(),
+                 reinterpret_cast<uintptr_t>(table), extents.rkey);
+    }
+  }
+  post(chain).get().value();
+  chain.clear();
+
+  struct candidate {
+    size_t i;
+    size_t d;
+    heap_t::rdma_ptr<unsigned char> data;
+  };
+  std::vector<candidate> candidates;
+  std::vector<bool> torn(end - begin);
+
+  for (size_t i = begin; i < end; i++) {
+    const auto entries = batch[i - begin].data();
+    const auto &key = keys[i];
+    if (!consistent(entries, n)) {
+      torn[i - begin] = true;
+      continue;
+    }
 
-  auto mem = heap.malloc<RDMAObj<hash_table_entry> >();
-  hydra::rdma::load(*this, *mem.first, mem.second, remote_index, rkey);
-  auto &entry = mem.first->get();
+    for (uint32_t c = candidates(entries, 0, n, fingerprint(hashes[i - begin]),
+                                key.size());
+         c; c &= c - 1) {
+      const size_t d = static_cast<size_t>(__builtin_ctz(c));
+      const auto &entry = entries[d].get();
+
+#if INLINE_THRESHOLD
+      if (entry.is_inline()) {
+        if (std::equal(std::begin(key), std::end(key), entry.inline_key())) {
+          values[i].assign(entry.inline_value(),
+                           entry.inline_value() + entry.value_length());
+          break;
+        }
+        continue;
+      }
+#endif
 
-  for (size_t hop = entry.hop, d = 1; hop; hop >>= 1, d++) {
-    if ((hop & 1) && !entry.is_empty() && (key.size() == entry.key_length())) {
       auto data = heap.malloc<unsigned char>(entry.ptr.size);
-      uint64_t crc = 0;
-      do {
-        read(data.first.get(), data.second, entry.key(), entry.rkey,
-             entry.ptr.size).get();
-        crc = hash64(data.first.get(), entry.ptr.size);
-      } while (entry.ptr.crc != crc);
-      if (std::equal(std::begin(key), std::end(key), data.first.get())) {
-        value.insert(std::end(value), data.first.get() + entry.key_length(),
-                     data.first.get() + entry.key_length() +
-                         entry.value_length());
-        return value;
-      }
+      chain.read(data.first.get(), entry.ptr.size, data.second,
+                 reinterpret_cast<uintptr_t>(entry.key()), entry.rkey);
+      candidates.push_back({ i, d, std::move(data) });
+    }
+  }
+  if (!chain.empty())
+    post(chain).get().value();
+
+  for (const auto &c : candidates) {
+    auto &value = values[c.i];
+    if (!value.empty())
+      continue;
+
+    const auto &entry = batch[c.i - begin][c.d].get();
+    const auto p = c.data.first.get();
+    if (!entry.ptr.matches(p)) {
+      torn[c.i - begin] = true;
+    } else if (std::equal(std::begin(keys[c.i]), std::end(keys[c.i]), p)) {
+      value.assign(p + entry.key_length(),
+                   p + entry.key_length() + entry.value_length());
     }
-    const size_t next_index = (index + d) % table_size;
-    remote_index = table_base + next_index * entry_size;
-    hydra::rdma::load(*this, *mem.first, mem.second, remote_index, rkey);
   }
 
-  return value;
+  for (size_t i = begin; i < end; i++) {
+    if (torn[i - begin] && values[i].empty())
+      retry.push_back(i);
+  }
+}
+
+/* Slots are only freed by acks, so the sends collected so far are posted
+ * before waiting for a slot.
+ */
+std::vector<bool> hydra::passive::multi_put(
+    const std::vector<std::pair<std::vector<unsigned char>, size_t> > &kvs) {
+  std::vector<hydra::future<bool> > futures;
+  futures.reserve(kvs.size());
+  std::vector<size_t> pending;
+  wr_chain chain;
+
+  auto flush = [&]() {
+    if (chain.empty())
+      return;
+    try {
+      post(chain);
+    }
+    catch (...) {
+      for (const auto index : pending)
+        abort(index);
+      throw;
+    }
+    chain.clear();
+    pending.clear();
+  };
+
+  for (const auto &kv : kvs) {
+    size_t index;
+    while (!try_acquire(index)) {
+      flush();
+      std::this_thread::yield();
+    }
+
+    try {
+      put_request(index, kv.first, kv.second);
+    }
+    catch (...) {
+      abort(index);
+      for (const auto index : pending)
+        abort(index);
+      throw;
+    }
+    futures.push_back(prepare(index));
+    pending.push_back(index);
+
+    const size_t size = slots[index].length;
+    chain.send(std::begin(buffers[index].request), size, buffers_mr.get(),
+               (size <= inline_limit()) ? IBV_SEND_INLINE : 0);
+  }
+  flush();
+
+  std::vector<bool> results;
+  results.reserve(futures.size());
+  for (auto &&future : futures)
+    results.push_back(future.get().value());
+  return results;
 }
 
 bool hydra::passive::contains(const std::vector<unsigned char> &key) {
@@ -159,6 +736,7 @@ void hydra::passive::init() {
 
   assert(reader.which() == hydra::protocol::DHTResponse::INIT);
 
+  binary = reader.getInit().getBinary();
   auto mr = reader.getInit().getInfo();
   assert(mr.getSize() >= sizeof(hydra::node_info));
 
@@ -1,51 +1,183 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
 #include <string>
 #include <memory>
 #include <vector>
 
 #include "rdma/RDMAClientSocket.h"
 #include "hydra/protocol/message.h"
+#include "hydra/protocol/binary.h"
 
 #include "allocators/ZoneHeap.h"
-#include "allocators/ThreadSafeHeap.h"
-#include "allocators/FreeListHeap.h"
-#include "allocators/SegregatedFitsHeap.h"
+#include "allocators/LockedHeap.h"
+#include "allocators/LockFreeFreeListHeap.h"
+#include "allocators/StaticSegregatedFitsHeap.h"
+#include "allocators/BuddyHeap.h"
+#include "allocators/allocators.h"
 #include "RDMAAllocator.h"
+#include "util/future.h"
 
 namespace hydra {
 class passive : public virtual RDMAClientSocket {
 public:
-  passive(const std::string &host, const std::string &port);
+  /* Memory of the caller, registered once with register_buffer(). */
+  struct registered_buffer {
+    unsigned char *data;
+    size_t size;
+    mr_t mr;
+  };
+
+  /* depth bounds the number of requests in flight */
+  passive(const std::string &host, const std::string &port,
+          const size_t depth = 32);
 
   bool put(const std::vector<unsigned char> &kv, const size_t &key_size);
   bool remove(const std::vector<unsigned char> &key);
   bool contains(const std::vector<unsigned char> &key);
   std::vector<unsigned char> get(const std::vector<unsigned char> &key);
 
+  hydra::future<bool> put_async(const std::vector<unsigned char> &kv,
+                                const size_t &key_size);
+  hydra::future<bool> remove_async(const std::vector<unsigned char> &key);
+
+  /* Large key/values are copied into a staging buffer by put(). Those already
+   * in registered memory are sent by put_registered(), which has the node read
+   * the size bytes at offset of buffer directly. They must not change until
+   * the future is ready.
+   */
+  registered_buffer register_buffer(unsigned char *data, const size_t size);
+  hydra::future<bool> put_registered(const registered_buffer &buffer,
+                                     const size_t offset, const size_t size,
+                                     const size_t key_size);
+  hydra::future<std::vector<unsigned char> >
+  get_async(const std::vector<unsigned char> &key);
+
+  /* The reads and sends of a batch are posted with a single doorbell. */
+  std::vector<std::vector<unsigned char> >
+  multi_get(const std::vector<std::vector<unsigned char> > &keys);
+  std::vector<bool> multi_put(
+      const std::vector<std::pair<std::vector<unsigned char>, size_t> > &kvs);
+
   size_t table_size();
 
 private:
+  struct lookup;
+
   void init();
   void update_info();
   std::vector<unsigned char> find_entry(const std::vector<unsigned char> &key);
 
-  using buffer_t =
-      kj::FixedArray<capnp::word, ((256 + 40) / sizeof(capnp::word) + 1)>;
-  std::unique_ptr<buffer_t> buffer;
-  mr_t buffer_mr;
+  bool try_acquire(size_t &index);
+  void wait(std::function<void(const size_t)> request);
+  void resume();
+  void release(const size_t index);
+  hydra::future<bool> prepare(const size_t index);
+  void abort(const size_t index);
+  template <typename F>
+  void send_request(const size_t index, hydra::promise<bool> *ack, F &&build);
+  template <typename F>
+  hydra::future<bool> submit(const size_t index, F &&build);
+  hydra::future<bool> enqueue(std::function<void(const size_t)> build);
+  void encode(const size_t index, const kj::Array<capnp::word> &message);
+  void put_request(const size_t index, const std::vector<unsigned char> &kv,
+                   const size_t &key_size);
+  void del_request(const size_t index, const std::vector<unsigned char> &key);
+
+  void get_batch(const std::vector<std::vector<unsigned char> > &keys,
+                 std::vector<std::vector<unsigned char> > &values,
+                 const size_t begin, const size_t end,
+                 std::vector<size_t> &retry);
 
-  SegregatedFitsHeap<
-      FreeListHeap<ZoneHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024> >,
-      ZoneHeap<RdmaHeap<ibv_access::READ>, 128 * 1024 * 1024> > heap;
+  void start(std::shared_ptr<lookup> l, const size_t slot);
+  void read_neighbourhood(std::shared_ptr<lookup> l);
+  void scan(std::shared_ptr<lookup> l, const size_t from);
+  void finish(const std::shared_ptr<lookup> &l,
+              std::vector<unsigned char> value);
+  void fail(const std::shared_ptr<lookup> &l, std::exception_ptr e);
+
+  /* Key/values below this size are sent within the request. */
+  enum { InlineSize = 256 };
+  using buffer_t = kj::FixedArray<
+      capnp::word, ((InlineSize + 64) / sizeof(capnp::word) + 1)>;
+  static_assert(sizeof(buffer_t) >= protocol::binary::max_size,
+                "Request buffer too small for binary messages");
+
+  /* Continuations of lookups allocate on the completion thread, concurrently
+   * with the calling thread. The bins are lock-free and only lock to grow;
+   * larger blocks come from a locked ZoneHeap.
+   */
+  using heap_t = StaticSegregatedFitsHeap<
+      default_size_class,
+      LockFreeFreeListHeap<
+          ZoneHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024> >,
+      LockedHeap<ZoneHeap<RdmaHeap<ibv_access::READ>, 128 * 1024 * 1024> > >;
+  heap_t heap;
+  /* Key/values of puts until the node has read them. Recycled, in powers of
+   * two; smaller puts are sent inline, so no block is below InlineSize.
+   * BuddyHeap locks internally.
+   */
+  using staging_t =
+      BuddyHeap<RdmaHeap<ibv_access::READ>, 16 * 1024 * 1024, InlineSize>;
+  staging_t staging;
 
   std::unique_ptr<hydra::node_info> info;
   mr_t info_mr;
+  /* node accepts protocol/binary.h messages */
+  bool binary = false;
 
   using response_t = kj::FixedArray<capnp::word, 9>;
   std::unique_ptr<response_t> response;
   mr_t response_mr;
 
+  /* The server's hop_range is bounded by the width of the hop mask. */
+  using neighbourhood_t =
+      std::array<RDMAObj<hash_table_entry>,
+                 std::numeric_limits<decltype(hash_table_entry::hop)>::digits>;
+
+  /* Every request in flight owns a slot: the message it sent, the
+   * neighbourhood of a lookup and the promise completed by the server's ack.
+   * The request id selects the slot, since acks are not necessarily received
+   * in the order the requests were sent.
+   */
+  struct slot_buffers {
+    buffer_t request;
+    neighbourhood_t entries;
+  };
+  struct slot {
+    std::atomic_bool busy{ false };
+    uint64_t id = 0;
+    size_t length = 0; /* of the request */
+    hydra::promise<bool> *ack = nullptr;
+    heap_t::rdma_ptr<unsigned char> kv;
+  };
+  std::vector<slot_buffers> buffers;
+  mr_t buffers_mr;
+  std::vector<slot> slots;
+  std::atomic<uint64_t> next_id{ 1 };
+  /* Requests which found no free slot. Slots are freed by acks, which only
+   * the completion thread receives, so nobody must wait for them there.
+   * Instead, release() hands freed slots to the waiting requests.
+   */
+  std::mutex waiting_mutex;
+  std::deque<std::function<void(const size_t)> > waiting;
+  std::atomic<size_t> n_waiting{ 0 };
+
+  /* neighbourhoods of a multi_get batch */
+  std::vector<neighbourhood_t> batch;
+  mr_t batch_mr;
+  std::mutex batch_mutex;
+
+  std::vector<response_t> responses;
+  mr_t responses_mr;
+  void post_recv(const response_t &response);
+  void complete(const uint64_t id, const bool success);
+
   mr remote;
 };
 }
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+
+/* Fixed-layout messages for the hot path: inline put, inline delete and the
+ * ack. They are decoded in place, without capnp and without allocation.
+ * Everything else, including INIT which announces support for these messages,
+ * still uses capnp.
+ *
+ * A flat capnp message starts with the number of segments minus one. The
+ * magic is far beyond the segment limit of capnp, so both kinds of message can
+ * share the receive buffers.
+ */
+namespace hydra {
+namespace protocol {
+namespace binary {
+
+static constexpr uint32_t magic = 0x52445948; /* "HYDR" */
+
+enum class opcode : uint8_t { put = 1, del = 2, ack = 3 };
+
+struct header {
+  uint32_t magic;
+  opcode op;
+  uint8_t success; /* ack */
+  uint8_t key_size;
+  uint8_t size; /* put: key and value, del: key */
+  uint64_t id;
+};
+
+static_assert(sizeof(header) == 16, "Unexpected padding in header");
+
+/* Largest message: a header followed by the biggest inline key/value pair. */
+static constexpr size_t max_size =
+    sizeof(header) + std::numeric_limits<uint8_t>::max();
+
+inline bool is_binary(const void *buffer) {
+  uint32_t word;
+  memcpy(&word, buffer, sizeof(word));
+  return word == magic;
+}
+
+inline const unsigned char *payload(const header &message) {
+  return reinterpret_cast<const unsigned char *>(&message + 1);
+}
+
+/* The encoders write into buffer, which must hold max_size bytes, and return
+ * the size of the message.
+ */
+inline size_t put(void *buffer, const unsigned char *kv, const size_t size,
+                  const size_t key_size, const uint64_t id) {
+  auto message = static_cast<header *>(buffer);
+  message->magic = magic;
+  message->op = opcode::put;
+  message->success = 0;
+  message->key_size = static_cast<uint8_t>(key_size);
+  message->size = static_cast<uint8_t>(size);
+  message->id = id;
+  memcpy(message + 1, kv, size);
+  return sizeof(header) + size;
+}
+
+inline size_t del(void *buffer, const unsigned char *key, const size_t size,
+                  const uint64_t id) {
+  auto message = static_cast<header *>(buffer);
+  message->magic = magic;
+  message->op = opcode::del;
+  message->success = 0;
+  message->key_size = static_cast<uint8_t>(size);
+  message->size = static_cast<uint8_t>(size);
+  message->id = id;
+  memcpy(message + 1, key, size);
+  return sizeof(header) + size;
+}
+
+inline header ack(const bool success, const uint64_t id) {
+  header message;
+  message.magic = magic;
+  message.op = opcode::ack;
+  message.success = success;
+  message.key_size = 0;
+  message.size = 0;
+  message.id = id;
+  return message;
+}
+}
+}
+}
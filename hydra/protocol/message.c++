@@ -18,12 +18,33 @@ kj::Array<capnp::word> init_message() {
   return messageToFlatArray(request);
 }
 
-kj::Array<capnp::word> ack_message(const bool success) {
+kj::Array<capnp::word> put_message(const unsigned char *kv, const size_t size,
+                                   const size_t key_size, const uint32_t rkey,
+                                   const uint64_t id) {
+  assert(key_size <= std::numeric_limits<uint32_t>::max());
+  assert(size <= std::numeric_limits<uint32_t>::max());
+  ::capnp::MallocMessageBuilder message;
+  hydra::protocol::DHTRequest::Builder msg =
+      message.initRoot<hydra::protocol::DHTRequest>();
+  msg.setId(id);
+
+  auto remote = msg.initPut().initRemote();
+  auto kv_mr = remote.initKv();
+  kv_mr.setAddr(reinterpret_cast<uint64_t>(kv));
+  kv_mr.setSize(static_cast<uint32_t>(size));
+  kv_mr.setRkey(rkey);
+  remote.setKeySize(static_cast<uint32_t>(key_size));
+
+  return messageToFlatArray(message);
+}
+
+kj::Array<capnp::word> ack_message(const bool success, const uint64_t id) {
   ::capnp::MallocMessageBuilder response;
   hydra::protocol::DHTResponse::Builder msg =
       response.initRoot<hydra::protocol::DHTResponse>();
 
   msg.initAck().setSuccess(success);
+  msg.setId(id);
   return messageToFlatArray(response);
 }
 
@@ -18,11 +18,16 @@ template <> size_t size_of(const kj::Array<capnp::word> &o);
 }
 
 kj::Array<capnp::word> init_message();
-kj::Array<capnp::word> ack_message(const bool);
+kj::Array<capnp::word> ack_message(const bool, const uint64_t id = 0);
+/* Key/value pair of size bytes at kv, which the node reads with rkey. */
+kj::Array<capnp::word> put_message(const unsigned char *kv, const size_t size,
+                                   const size_t key_size, const uint32_t rkey,
+                                   const uint64_t id);
 
 template <typename T>
 kj::Array<capnp::word> put_message(const T &kv, const size_t &key_size,
-                                   const uint32_t rkey) {
+                                   const uint32_t rkey,
+                                   const uint64_t id = 0) {
   using namespace hydra::rdma;
   const size_t size = size_of(kv);
   const void *ptr = address_of(kv);
@@ -31,6 +36,7 @@ kj::Array<capnp::word> put_message(const T &kv, const size_t &key_size,
   ::capnp::MallocMessageBuilder message;
   hydra::protocol::DHTRequest::Builder msg =
       message.initRoot<hydra::protocol::DHTRequest>();
+  msg.setId(id);
 
   auto remote = msg.initPut().initRemote();
   auto kv_mr = remote.initKv();
@@ -44,25 +50,15 @@ kj::Array<capnp::word> put_message(const T &kv, const size_t &key_size,
 
 template <typename T>
 kj::Array<capnp::word> put_message(const rdma_ptr<T> &kv, const size_t &size,
-                                   const size_t &key_size) {
-  assert(key_size <= std::numeric_limits<uint32_t>::max());
-  assert(size <= std::numeric_limits<uint32_t>::max());
-  ::capnp::MallocMessageBuilder message;
-  hydra::protocol::DHTRequest::Builder msg =
-      message.initRoot<hydra::protocol::DHTRequest>();
-
-  auto remote = msg.initPut().initRemote();
-  auto kv_mr = remote.initKv();
-  kv_mr.setAddr(reinterpret_cast<uint64_t>(kv.first.get()));
-  kv_mr.setSize(static_cast<uint32_t>(size));
-  kv_mr.setRkey(kv.second->rkey);
-  remote.setKeySize(static_cast<uint32_t>(key_size));
-
-  return messageToFlatArray(message);
+                                   const size_t &key_size,
+                                   const uint64_t id = 0) {
+  return put_message(reinterpret_cast<const unsigned char *>(kv.first.get()),
+                     size, key_size, kv.second->rkey, id);
 }
 
 template <typename T>
-kj::Array<capnp::word> put_message_inline(const T &o, const size_t &key_size) {
+kj::Array<capnp::word> put_message_inline(const T &o, const size_t &key_size,
+                                          const uint64_t id = 0) {
   using namespace hydra::rdma;
   const size_t size = size_of(o);
   const void *ptr = address_of(o);
@@ -72,6 +68,7 @@ kj::Array<capnp::word> put_message_inline(const T &o, const size_t &key_size) {
   ::capnp::MallocMessageBuilder message;
   hydra::protocol::DHTRequest::Builder msg =
       message.initRoot<hydra::protocol::DHTRequest>();
+  msg.setId(id);
 
   auto put = msg.initPut().initInline();
 
@@ -85,10 +82,12 @@ kj::Array<capnp::word> put_message_inline(const T &o, const size_t &key_size) {
 
 template <typename T>
 kj::Array<capnp::word> del_message(const rdma_ptr<T> &key,
-                                   const size_t &key_size) {
+                                   const size_t &key_size,
+                                   const uint64_t id = 0) {
   ::capnp::MallocMessageBuilder message;
   hydra::protocol::DHTRequest::Builder msg =
       message.initRoot<hydra::protocol::DHTRequest>();
+  msg.setId(id);
 
   auto remote = msg.initDel().initRemote();
   auto key_mr = remote.initKey();
@@ -99,7 +98,8 @@ kj::Array<capnp::word> del_message(const rdma_ptr<T> &key,
   return messageToFlatArray(message);
 }
 
-template <typename T> kj::Array<capnp::word> del_message_inline(const T &key) {
+template <typename T>
+kj::Array<capnp::word> del_message_inline(const T &key, const uint64_t id = 0) {
   using namespace hydra::rdma;
   const size_t size = size_of(key);
   const void *ptr = address_of(key);
@@ -109,6 +109,7 @@ template <typename T> kj::Array<capnp::word> del_message_inline(const T &key) {
   ::capnp::MallocMessageBuilder message;
   hydra::protocol::DHTRequest::Builder msg =
       message.initRoot<hydra::protocol::DHTRequest>();
+  msg.setId(id);
 
   auto remote = msg.initDel().initInline();
   remote.setSize(static_cast<uint8_t>(size));
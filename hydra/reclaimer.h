@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "util/concurrent.h"
+
+namespace hydra {
+
+/* Deferred destruction of memory that remote peers may still be reading.
+ *
+ * A passive client reads an entry and then the key/value it points to with two
+ * RDMA reads; in between the owner may overwrite or remove the entry. Until the
+ * client has noticed the change, it must not see the memory reused for another
+ * key. Retired pointers are therefore kept until two epochs have ended, i.e. at
+ * least one full epoch of grace_period. Epochs advance with time, checked
+ * whenever something is retired or collect() is called. grace_period has to
+ * bound the time a client takes from reading an entry to reading its
+ * key/value; a client taking longer notices by the checksum.
+ */
+template <typename Pointer> class epoch_reclaimer {
+  using clock = std::chrono::steady_clock;
+  using bucket_t = std::vector<Pointer>;
+
+  std::chrono::nanoseconds grace_period;
+  uint64_t epoch;
+  clock::time_point epoch_start;
+  /* retired in epoch e go into buckets[e % 2] */
+  std::array<bucket_t, 2> buckets;
+  std::atomic<size_t> pending_;
+  hydra::spinlock lock;
+
+  /* caller holds lock; returns the bucket which became free */
+  bucket_t advance(const clock::time_point now) {
+    bucket_t expired;
+    if (now - epoch_start < grace_period)
+      return expired;
+    epoch++;
+    epoch_start = now;
+    expired.swap(buckets[epoch % 2]);
+    return expired;
+  }
+
+  void destroy(bucket_t &expired) {
+    pending_ -= expired.size();
+    /* runs the deleters outside of the lock */
+    expired.clear();
+  }
+
+public:
+  explicit epoch_reclaimer(const std::chrono::microseconds grace_period =
+                               std::chrono::milliseconds(10))
+      : grace_period(grace_period), epoch(0), epoch_start(clock::now()),
+        pending_(0) {}
+  epoch_reclaimer(const epoch_reclaimer &) = delete;
+
+  /* upper bound of the time between reading an entry and its key/value */
+  void set_grace_period(const std::chrono::microseconds period) {
+    std::unique_lock<hydra::spinlock> l(lock);
+    grace_period = period;
+  }
+
+  void retire(Pointer p) {
+    if (!p)
+      return;
+    bucket_t expired;
+    {
+      std::unique_lock<hydra::spinlock> l(lock);
+      buckets[epoch % 2].push_back(std::move(p));
+      pending_++;
+      expired = advance(clock::now());
+    }
+    destroy(expired);
+  }
+
+  /* Frees what has become safe, without retiring anything. */
+  void collect() {
+    bucket_t expired;
+    {
+      std::unique_lock<hydra::spinlock> l(lock);
+      expired = advance(clock::now());
+    }
+    destroy(expired);
+  }
+
+  /* number of retired pointers not freed yet */
+  size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+};
+}
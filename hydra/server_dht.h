@@ -2,15 +2,25 @@
 
 #include <cstdint>
 #include <memory>
+#include <new>
 #include <utility>
 #include <functional>
 #include <vector>
 #include <ostream>
+#include <atomic>
 
 #include "types.h"
+#include "reclaimer.h"
 #include "util/concurrent.h"
 
-#define PER_ENTRY_LOCKS 0
+/* If set, hopscotch_server synchronizes internally (lock striping) and node
+ * calls into the DHT from multiple threads without a global monitor.
+ * cuckoo_server is not thread-safe and requires STRIPED_LOCKS 0 (cmake
+ * -DSTRIPED_LOCKS=OFF).
+ */
+#ifndef STRIPED_LOCKS
+#define STRIPED_LOCKS 1
+#endif
 
 namespace hydra {
 class server_dht {
@@ -26,10 +36,12 @@ protected:
   typedef std::pair<mem_type, mr_type> resource_type;
 
   LocalRDMAObj<hash_table_entry> *table = nullptr;
-  size_t used_ = 0;
+  std::atomic<size_t> used_{0};
   size_t table_size = 0;
-  size_t rehash_count = 0;
+  std::atomic<size_t> rehash_count{0};
   const double growth_factor;
+  /* key/values removed or overwritten, until remote reads have finished */
+  epoch_reclaimer<mem_type> reclaimer;
 
   bool index_valid(size_t index) const { return index < table_size; }
   bool index_invalid(size_t index) const { return !index_valid(index); }
@@ -46,8 +58,31 @@ public:
   virtual Return_t add(std::tuple<mem_type, size_t, size_t, uint32_t>& e) = 0;
   virtual Return_t remove(const key_type &key) = 0;
   virtual size_t contains(const key_type &key) = 0;
-  virtual void resize(LocalRDMAObj<hash_table_entry> *new_table,
-                      size_t size) = 0;
+  /* Points the entry of key, whose key/value is stored at key.first, at a
+   * copy of it in to, and retires the previous location. Returns false and
+   * leaves to alone if the key has been overwritten or removed meanwhile.
+   */
+  virtual bool relocate(const key_type &key, mem_type &to, uint32_t rkey) = 0;
+  /* Makes new_table the current table. Returns NEED_RESIZE, and leaves the
+   * tables as they were, if entries already in the tables do not fit.
+   */
+  virtual Return_t resize(LocalRDMAObj<hash_table_entry> *new_table,
+                          size_t size) = 0;
+  /* Sets up new_table for a later resize() to it, without holding up adds or
+   * removes, so it may run on a thread of its own. resize() sets up tables it
+   * was not given here itself.
+   */
+  virtual void prepare(LocalRDMAObj<hash_table_entry> *new_table,
+                       size_t size) {
+    for (size_t i = 0; i < size; i++)
+      new (&new_table[i]) LocalRDMAObj<hash_table_entry>;
+  }
+  /* true while the table passed to the previous resize() is still in use */
+  virtual bool resizing() const { return false; }
+  /* Moves what is left in the old table into the current one. Returns false
+   * if an entry did not fit, which leaves the rest to the next resize().
+   */
+  virtual bool drain() { return true; }
 
   virtual void check_consistency() const = 0;
   virtual void dump() const = 0;
@@ -59,6 +94,10 @@ public:
   }
   double load_factor() const noexcept { return double(used_) / table_size; }
   size_t rehashes() const noexcept { return rehash_count; }
+  void set_grace_period(const std::chrono::microseconds period) {
+    reclaimer.set_grace_period(period);
+  }
+  size_t pending_reclamation() const noexcept { return reclaimer.pending(); }
 };
 }
 
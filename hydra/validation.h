@@ -0,0 +1,244 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <nmmintrin.h>
+
+#include <city.h>
+
+/* Checksum of key/value pairs (verifying_ptr): 1 for CRC32C, 0 for
+ * CityHash64. Clients and nodes have to agree.
+ */
+#ifndef CRC32C_CHECKSUM
+#define CRC32C_CHECKSUM 1
+#endif
+
+/* How readers of RDMAObj detect torn copies: 0 checksums the object with
+ * CityHash64, 1 puts a version before and after it, which writers bump without
+ * reading the object. The latter relies on the NIC reading objects in address
+ * order.
+ */
+#ifndef SEQLOCK_VALIDATION
+#define SEQLOCK_VALIDATION 0
+#endif
+
+namespace hydra {
+
+/* Checksums provide
+ *   static uint64_t checksum(const void *p, size_t size);
+ */
+struct city_checksum {
+  static uint64_t checksum(const void *p, const size_t size) {
+    return CityHash64(static_cast<const char *>(p), size);
+  }
+};
+
+/* CRC32C, with the SSE4.2 instruction if the CPU has it. Its latency is three
+ * times its throughput, so large inputs are split into three streams whose
+ * CRCs are combined by shifting them over the length of the following ones.
+ */
+struct crc32c_checksum {
+  static uint64_t checksum(const void *p, const size_t size) {
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    const auto data = static_cast<const unsigned char *>(p);
+    return sse42 ? hardware(data, size) : software(data, size);
+  }
+
+private:
+  /* reflected Castagnoli polynomial */
+  static constexpr uint32_t Polynomial = 0x82f63b78;
+  /* bytes per stream */
+  static constexpr size_t Long = 8192;
+  static constexpr size_t Short = 256;
+
+  struct byte_table {
+    uint32_t table[256];
+
+    constexpr byte_table() : table() {
+      for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (unsigned i = 0; i < 8; i++)
+          crc = (crc & 1) ? (crc >> 1) ^ Polynomial : crc >> 1;
+        table[b] = crc;
+      }
+    }
+  };
+
+  static uint32_t update(const uint32_t crc, const unsigned char b) {
+    static constexpr byte_table bytes{};
+    return bytes.table[(crc ^ b) & 0xff] ^ (crc >> 8);
+  }
+
+  /* Advances a CRC over length zero bytes, one lookup per byte of the CRC.
+   * The shift is linear, so it is built from the shifts of single bits.
+   */
+  struct zeros {
+    uint32_t table[4][256];
+
+    explicit zeros(const size_t length) {
+      uint32_t bits[32];
+      for (unsigned i = 0; i < 32; i++) {
+        uint32_t crc = uint32_t(1) << i;
+        for (size_t n = 0; n < length; n++)
+          crc = update(crc, 0);
+        bits[i] = crc;
+      }
+      for (unsigned k = 0; k < 4; k++) {
+        for (unsigned b = 0; b < 256; b++) {
+          uint32_t crc = 0;
+          for (unsigned i = 0; i < 8; i++) {
+            if (b & (1U << i))
+              crc ^= bits[8 * k + i];
+          }
+          table[k][b] = crc;
+        }
+      }
+    }
+
+    uint32_t shift(const uint64_t crc) const {
+      return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff] ^
+             table[2][(crc >> 16) & 0xff] ^ table[3][(crc >> 24) & 0xff];
+    }
+  };
+
+  static uint64_t load(const unsigned char *p) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    return word;
+  }
+
+  /* consumes blocks of three streams of length bytes each */
+  __attribute__((target("sse4.2"))) static uint64_t
+  streams(uint64_t crc0, const unsigned char *&p, size_t &size,
+          const size_t length, const zeros &shift) {
+    while (size >= 3 * length) {
+      uint64_t crc1 = 0;
+      uint64_t crc2 = 0;
+      for (const unsigned char *end = p + length; p < end; p += 8) {
+        crc0 = _mm_crc32_u64(crc0, load(p));
+        crc1 = _mm_crc32_u64(crc1, load(p + length));
+        crc2 = _mm_crc32_u64(crc2, load(p + 2 * length));
+      }
+      crc0 = shift.shift(crc0) ^ crc1;
+      crc0 = shift.shift(crc0) ^ crc2;
+      p += 2 * length;
+      size -= 3 * length;
+    }
+    return crc0;
+  }
+
+  __attribute__((target("sse4.2"))) static uint32_t
+  hardware(const unsigned char *p, size_t size) {
+    static const zeros long_shift(Long);
+    static const zeros short_shift(Short);
+
+    uint64_t crc = ~uint32_t(0);
+    crc = streams(crc, p, size, Long, long_shift);
+    crc = streams(crc, p, size, Short, short_shift);
+    for (; size >= 8; p += 8, size -= 8)
+      crc = _mm_crc32_u64(crc, load(p));
+    uint32_t tail = static_cast<uint32_t>(crc);
+    for (; size; p++, size--)
+      tail = _mm_crc32_u8(tail, *p);
+    return ~tail;
+  }
+
+  static uint32_t software(const unsigned char *p, size_t size) {
+    uint32_t crc = ~uint32_t(0);
+    for (; size; p++, size--)
+      crc = update(crc, *p);
+    return ~crc;
+  }
+};
+
+#if CRC32C_CHECKSUM
+using default_checksum = crc32c_checksum;
+#else
+using default_checksum = city_checksum;
+#endif
+
+/* selects the constructor which builds the object from its arguments */
+struct construct_t {};
+constexpr construct_t construct{};
+
+/* Validation policies of RDMAObj lay out the object together with whatever
+ * they need to validate it:
+ *   template <typename T> struct layout;
+ * holding the object as obj, constructible from construct and the arguments
+ * of the object, and providing
+ *   void begin();       before obj is modified in place
+ *   void seal();        after obj has been modified
+ *   bool valid() const; on a copy read over RDMA
+ */
+template <typename Checksum, typename Word = uint64_t>
+struct checksum_validation {
+  /* Word may cut the checksum short, to keep small objects small */
+  template <typename T> struct layout {
+    T obj;
+    Word crc;
+
+    template <typename... Args>
+    explicit layout(construct_t, Args &&... args)
+        : obj(std::forward<Args>(args)...) {
+      seal();
+    }
+
+    void begin() {}
+    void seal() {
+      crc = static_cast<Word>(Checksum::checksum(&obj, sizeof(T)));
+    }
+    bool valid() const {
+      return static_cast<Word>(Checksum::checksum(&obj, sizeof(T))) == crc;
+    }
+  };
+};
+
+/* A reader copies version, obj and trailer in address order, so the writer
+ * stores in the opposite order: begin() makes the trailer odd, then obj is
+ * modified, then seal() moves the version in front to the next even value
+ * and copies it to the trailer. A copy whose obj overlapped a write has taken
+ * its version before seal() and its trailer after begin(), so they differ.
+ * Objects must have a single writer at a time.
+ */
+struct seqlock_validation {
+  template <typename T> struct layout {
+    uint64_t version;
+    T obj;
+    uint64_t trailer;
+
+    template <typename... Args>
+    explicit layout(construct_t, Args &&... args)
+        : version(0), obj(std::forward<Args>(args)...), trailer(0) {}
+
+    void begin() {
+      trailer = version + 1;
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    void seal() {
+      std::atomic_thread_fence(std::memory_order_release);
+      version = trailer + 1;
+      std::atomic_thread_fence(std::memory_order_release);
+      trailer = version;
+    }
+    bool valid() const { return !(version & 1) && version == trailer; }
+  };
+};
+
+/* Objects are a cache line or two, too short for the streams of CRC32C. */
+#if SEQLOCK_VALIDATION
+using default_validation = seqlock_validation;
+#else
+using default_validation = checksum_validation<city_checksum>;
+#endif
+
+/* The validation of RDMAObj<T>, unless given. Specialized by types which need
+ * another one.
+ */
+template <typename T> struct validation_of {
+  using type = default_validation;
+};
+}
@@ -2,9 +2,14 @@
 
 #include <memory>
 #include <cstdint>
-#include "hash.h"
+#include <limits>
 
-template <typename T> struct verifying_ptr {
+#include <assert.h>
+
+#include "validation.h"
+
+template <typename T, typename Checksum = hydra::default_checksum>
+struct verifying_ptr {
   uint64_t ptr;
   //(u)int32_t might suffice
   size_t size;
@@ -13,7 +18,7 @@ template <typename T> struct verifying_ptr {
   verifying_ptr(const T *p, size_t s) noexcept
       : ptr(reinterpret_cast<uint64_t>(p)),
         size(s),
-        crc(::hydra::hash64(p, s)) {}
+        crc(Checksum::checksum(p, s)) {}
   verifying_ptr &operator=(const verifying_ptr &) = default;
   verifying_ptr &operator=(verifying_ptr &&other) {
     ptr = other.ptr;
@@ -29,8 +34,62 @@ template <typename T> struct verifying_ptr {
   void reset() {
     ptr = reinterpret_cast<uint64_t>(nullptr);
     size = 0;
-    crc = ::hydra::hash64(nullptr, 0);
+    crc = Checksum::checksum(nullptr, 0);
+  }
+  /* whether the size bytes at p, read from ptr, are what crc was taken of */
+  bool matches(const void *p) const {
+    return Checksum::checksum(p, size) == crc;
   }
   //  void update() { crc = hash64(reinterpret_cast<void*>(ptr), size); }
 };
 
+
+/* verifying_ptr in 16 bytes, for small table slots: user space addresses are
+ * 48 bits wide on x86-64, sizes stay below 4 GiB and the checksum is cut to
+ * 32 bits, which CRC32C does not exceed anyway. The 16 bits above the address
+ * are left to the owner (tag).
+ */
+template <typename T, typename Checksum = hydra::default_checksum>
+struct compact_verifying_ptr {
+  uint32_t ptr_low;
+  uint16_t ptr_high;
+  uint16_t tag;
+  uint32_t size;
+  uint32_t crc;
+
+  compact_verifying_ptr(const T *p, size_t s, const uint16_t tag = 0) noexcept
+      : ptr_low(static_cast<uint32_t>(reinterpret_cast<uint64_t>(p))),
+        ptr_high(static_cast<uint16_t>(reinterpret_cast<uint64_t>(p) >> 32)),
+        tag(tag),
+        size(static_cast<uint32_t>(s)),
+        crc(static_cast<uint32_t>(Checksum::checksum(p, s))) {
+    assert((reinterpret_cast<uint64_t>(p) >> 48) == 0);
+    assert(s <= std::numeric_limits<uint32_t>::max());
+  }
+  compact_verifying_ptr &operator=(const compact_verifying_ptr &) = default;
+  compact_verifying_ptr &operator=(compact_verifying_ptr &&other) {
+    ptr_low = other.ptr_low;
+    ptr_high = other.ptr_high;
+    tag = other.tag;
+    size = other.size;
+    crc = other.crc;
+    other.reset();
+    return *this;
+  }
+  compact_verifying_ptr() noexcept : compact_verifying_ptr(nullptr, 0) {}
+  const T *get() const {
+    return reinterpret_cast<T *>((uint64_t(ptr_high) << 32) | ptr_low);
+  }
+  bool is_empty() const { return get() == nullptr; }
+  operator bool() const { return get() != nullptr; }
+  void reset() {
+    ptr_low = 0;
+    ptr_high = 0;
+    tag = 0;
+    size = 0;
+    crc = static_cast<uint32_t>(Checksum::checksum(nullptr, 0));
+  }
+  bool matches(const void *p) const {
+    return static_cast<uint32_t>(Checksum::checksum(p, size)) == crc;
+  }
+};
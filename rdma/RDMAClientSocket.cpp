@@ -25,7 +25,8 @@ RDMAClientSocket::RDMAClientSocket(const std::string &host,
   attr.send_cq = cq;
   attr.srq = srq_id->srq;
   attr.qp_type = IBV_QPT_UC;
-  attr.sq_sig_all = 1;
+  /* wr_chain relies on unsignaled work requests */
+  attr.sq_sig_all = 0;
 
   for (max_inline_data = 1;; max_inline_data = attr.cap.max_inline_data + 1) {
     attr.cap.max_inline_data = max_inline_data;
@@ -33,13 +33,18 @@ public:
   ~RDMAClientSocket();
   void connect() const;
   void disconnect() const;
+
+  cq_stats stats() const { return cq.stats(); }
+  void set_polling(const polling_policy &policy) { cc.set_policy(policy); }
   
   template <typename T>
   auto send(const T &local, const ibv_mr *mr = nullptr) const {
     using namespace hydra::rdma;
-    const void *ptr = address_of(local);
-    const size_t size = size_of(local);
-    int flags = 0;
+    send(address_of(local), size_of(local), mr);
+  }
+
+  void send(const void *ptr, const size_t size, const ibv_mr *mr) const {
+    int flags = IBV_SEND_SIGNALED;
     if (size <= max_inline_data) {
       flags |= IBV_SEND_INLINE;
     } else if (mr == nullptr) {
@@ -70,6 +75,15 @@ public:
                              reinterpret_cast<uintptr_t>(remote), rkey);
   }
 
+  /* Post the chain with a single doorbell. The buffers it refers to must stay
+   * valid until the returned future is ready.
+   */
+  hydra::future<qp_t> post(wr_chain &chain) const {
+    return chain.post(id->qp);
+  }
+
+  size_t inline_limit() const { return max_inline_data; }
+
   template <typename T>
   auto recv_async(const T &local, const ibv_mr *mr) const {
     using namespace hydra::rdma;
@@ -1,5 +1,6 @@
 #include <stdexcept>
 #include <future>
+#include <fstream>
 
 #include <sys/select.h>
 #include <assert.h>
@@ -23,24 +24,44 @@ mr_t register_memory(const RDMAServerSocket &socket, const ibv_access &flags,
 }
 }
 
+RDMAServerSocket::worker::worker(const rdma_id_ptr &id, int cq_entries,
+                                 ibv_srq *srq)
+    : cc(id), cq(id, cc, cq_entries, 1, 0), srq(srq) {}
+
+RDMAServerSocket::worker::worker(const rdma_id_ptr &id, int cq_entries,
+                                 ibv_srq_init_attr &attr)
+    : cc(id), cq(id, cc, cq_entries, 1, 0),
+      own_srq(check_nonnull(ibv_create_srq(id->pd, &attr))),
+      srq(own_srq.get()) {}
+
 RDMAServerSocket::RDMAServerSocket(const std::string &host,
                                    const std::string &port, uint32_t max_wr,
-                                   int cq_entries)
+                                   int cq_entries, size_t n_workers)
     : RDMAServerSocket(std::vector<std::string>({ host }), port, max_wr,
-                       cq_entries) {}
+                       cq_entries, n_workers) {}
 
 RDMAServerSocket::RDMAServerSocket(std::vector<std::string> hosts,
                                    const std::string &port, uint32_t max_wr,
-                                   int cq_entries)
+                                   int cq_entries, size_t n_workers)
     : ec(createEventChannel()), id(createCmId(hosts.back(), port, true)),
-      cc(id), cq(id, cc, cq_entries, 1, 0), running(true) {
+      next_worker(0), running(true) {
   assert(max_wr);
+  assert(n_workers);
 
   check_zero(rdma_migrate_id(id.get(), ec.get()));
 
   ibv_srq_init_attr srq_attr = { nullptr, { max_wr, 1, 0 } };
   check_zero(rdma_create_srq(id.get(), nullptr, &srq_attr));
 
+  /* The first worker uses the SRQ of the listening id. */
+  workers.push_back(std::make_unique<worker>(id, cq_entries, id->srq));
+  for (size_t i = 1; i < n_workers; i++)
+    workers.push_back(std::make_unique<worker>(id, cq_entries, srq_attr));
+
+  const unsigned cpus = std::max(1U, std::thread::hardware_concurrency());
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i]->cc.pin(static_cast<unsigned>(i % cpus));
+
   log_info() << "Created id " << id.get() << " " << (void *)this;
   hosts.pop_back();
 
@@ -50,8 +71,8 @@ RDMAServerSocket::RDMAServerSocket(std::vector<std::string> hosts,
     attr.cap.max_recv_wr = 0;
     attr.cap.max_send_sge = 1;
     attr.cap.max_recv_sge = 0;
-    attr.recv_cq = cq;
-    attr.send_cq = cq;
+    attr.recv_cq = workers.front()->cq;
+    attr.send_cq = workers.front()->cq;
     attr.srq = id->srq;
     attr.cap.max_inline_data = 72;
     attr.sq_sig_all = 1;
@@ -97,6 +118,7 @@ void RDMAServerSocket::listen(int backlog) {
 }
 
 void RDMAServerSocket::accept(client_t client_id) const {
+  const auto &worker = *workers[next_worker++ % workers.size()];
   ibv_qp_init_attr qp_attr = {};
   qp_attr.qp_type = IBV_QPT_RC;
   qp_attr.cap.max_send_wr = 256;
@@ -104,21 +126,22 @@ void RDMAServerSocket::accept(client_t client_id) const {
   qp_attr.cap.max_send_sge = 1;
   qp_attr.cap.max_recv_sge = 0;
   qp_attr.cap.max_inline_data = 72;
-  qp_attr.recv_cq = cq;
-  qp_attr.send_cq = cq;
-  qp_attr.srq = id->srq;
+  qp_attr.recv_cq = worker.cq;
+  qp_attr.send_cq = worker.cq;
+  qp_attr.srq = worker.srq;
   qp_attr.sq_sig_all = 1;
 
   check_zero(rdma_create_qp(client_id.get(), NULL, &qp_attr));
 
   check_zero(rdma_accept(client_id.get(), nullptr));
 
-  clients([client_id = std::move(client_id)](auto && clients) mutable {
+  clients([ this, client_id = std::move(client_id) ](auto && clients) mutable {
     auto pos = std::lower_bound(std::begin(clients), std::end(clients),
                                 client_id->qp->qp_num,
                                 [](const auto &client, const qp_t &qp_num) {
       return client->qp->qp_num < qp_num;
     });
+    index.insert(client_id->qp->qp_num, client_id.get());
     clients.insert(pos, std::move(client_id));
   });
 }
@@ -161,3 +184,15 @@ mr_t RDMAServerSocket::register_memory(const ibv_access &flags, const void *ptr,
   return ::register_memory(id->pd, flags, ptr, size);
 }
 
+int RDMAServerSocket::numa_node() const {
+  if (id->verbs == nullptr)
+    return -1;
+  std::ifstream file(std::string("/sys/class/infiniband/") +
+                     ibv_get_device_name(id->verbs->device) +
+                     "/device/numa_node");
+  int node = -1;
+  if (!(file >> node))
+    return -1;
+  return node;
+}
+
@@ -33,14 +33,107 @@ private:
     }
   };
   using client_t = std::unique_ptr<rdma_cm_id, client_id_deleter>;
+  struct srq_deleter {
+    void operator()(ibv_srq *srq) { check_zero(ibv_destroy_srq(srq)); }
+  };
+
+  /* Connections are spread over the workers. Each has its own SRQ and CQ,
+   * and completions, including those of receives, are handled on the
+   * worker's poller thread.
+   */
+  struct worker {
+    completion_channel cc;
+    completion_queue cq;
+    std::unique_ptr<ibv_srq, srq_deleter> own_srq;
+    ibv_srq *srq;
+    worker(const rdma_id_ptr &id, int cq_entries, ibv_srq *srq);
+    worker(const rdma_id_ptr &id, int cq_entries, ibv_srq_init_attr &attr);
+  };
+
+  /* The rdma_cm_id of each qp, for replies, which look it up without taking
+   * a lock. Clients are only ever added, holding the clients lock, and keep
+   * their rdma_cm_id until the socket is gone. The slots are open addressed;
+   * a half full table is replaced by one twice the size. Replaced tables are
+   * kept for readers still probing them, which at most doubles the memory.
+   */
+  class client_index {
+    struct slot {
+      std::atomic<qp_t> qp_num; /* 0 if free; RC QPs are never 0 */
+      std::atomic<rdma_cm_id *> id;
+    };
+    struct table {
+      std::unique_ptr<slot[]> slots;
+      size_t mask;
+      size_t used = 0;
+      explicit table(const size_t size)
+          : slots(new slot[size]), mask(size - 1) {
+        for (size_t i = 0; i < size; i++) {
+          slots[i].qp_num.store(0, std::memory_order_relaxed);
+          slots[i].id.store(nullptr, std::memory_order_relaxed);
+        }
+      }
+    };
+
+    std::vector<std::unique_ptr<table> > tables;
+    std::atomic<const table *> current;
+
+    static size_t first(const table &t, const qp_t qp_num) {
+      return static_cast<size_t>((qp_num * 0x9e3779b97f4a7c15ull) >> 32) &
+             t.mask;
+    }
+    static void place(table &t, const qp_t qp_num, rdma_cm_id *id) {
+      size_t i = first(t, qp_num);
+      while (t.slots[i].qp_num.load(std::memory_order_relaxed))
+        i = (i + 1) & t.mask;
+      t.slots[i].id.store(id, std::memory_order_relaxed);
+      t.slots[i].qp_num.store(qp_num, std::memory_order_release);
+      t.used++;
+    }
+
+  public:
+    client_index() {
+      tables.push_back(std::make_unique<table>(64));
+      current.store(tables.back().get(), std::memory_order_release);
+    }
+
+    rdma_cm_id *find(const qp_t qp_num) const {
+      const table &t = *current.load(std::memory_order_acquire);
+      for (size_t i = first(t, qp_num);; i = (i + 1) & t.mask) {
+        const qp_t qp = t.slots[i].qp_num.load(std::memory_order_acquire);
+        if (qp == qp_num)
+          return t.slots[i].id.load(std::memory_order_relaxed);
+        if (!qp)
+          return nullptr;
+      }
+    }
+
+    /* Requires the clients lock. */
+    void insert(const qp_t qp_num, rdma_cm_id *id) {
+      table *t = tables.back().get();
+      if (2 * (t->used + 1) > t->mask + 1) {
+        auto next = std::make_unique<table>(2 * (t->mask + 1));
+        for (size_t i = 0; i <= t->mask; i++) {
+          const qp_t qp = t->slots[i].qp_num.load(std::memory_order_relaxed);
+          if (qp)
+            place(*next, qp, t->slots[i].id.load(std::memory_order_relaxed));
+        }
+        tables.push_back(std::move(next));
+        t = tables.back().get();
+      }
+      place(*t, qp_num, id);
+      current.store(t, std::memory_order_release);
+    }
+  };
+
   ec_ptr ec;
   rdma_id_ptr id;
   std::vector<rdma_id_ptr> ids;
-  completion_channel cc;
-  completion_queue cq;
+  std::vector<std::unique_ptr<worker> > workers;
+  mutable std::atomic<size_t> next_worker;
   WorkerThread eventThread;
   std::atomic_bool running;
   mutable monitor<std::vector<RDMAServerSocket::client_t> > clients;
+  mutable client_index index;
 
   void accept(client_t id) const;
   void cm_events() const;
@@ -73,9 +166,11 @@ private:
 
 public:
   RDMAServerSocket(std::vector<std::string> hosts, const std::string &port,
-                   uint32_t max_wr = 16383, int cq_entries = 131071);
+                   uint32_t max_wr = 16383, int cq_entries = 131071,
+                   size_t n_workers = 1);
   RDMAServerSocket(const std::string &host, const std::string &port,
-                   uint32_t max_wr = 16383, int cq_entries = 131071);
+                   uint32_t max_wr = 16383, int cq_entries = 131071,
+                   size_t n_workers = 1);
   ~RDMAServerSocket();
   template <typename Functor> void operator()(Functor &&functor) const {
     return clients([=](const auto &clients) {
@@ -85,24 +180,17 @@ public:
     });
   }
 
+  /* Runs functor with the rdma_cm_id of qp_num, without holding any lock. */
   template <typename Functor>
   auto operator()(const qp_t qp_num, Functor &&functor)
       const -> typename std::result_of<Functor(rdma_cm_id *)>::type {
-    return clients([ functor = std::move(functor), qp_num ]
-        (const auto & clients) {
-          auto client = std::lower_bound(std::begin(clients),
-              std::end(clients), qp_num,
-              [](const auto &client, const qp_t &qp_num) {
-                return client->qp->qp_num < qp_num;
-          });
-          if ((*client)->qp->qp_num == qp_num) {
-            return functor(client->get());
-          } else {
-            std::ostringstream s;
-            s << "rdma_cm_id* for qp " << qp_num << " not found." << std::endl;
-            throw std::runtime_error(s.str());
-          }
-    });
+    rdma_cm_id *client = index.find(qp_num);
+    if (!client) {
+      std::ostringstream s;
+      s << "rdma_cm_id* for qp " << qp_num << " not found." << std::endl;
+      throw std::runtime_error(s.str());
+    }
+    return functor(client);
   }
 
   void disconnect(const qp_t qp_num) const;
@@ -122,6 +210,23 @@ public:
     return rdma_recv_async(id.get(), ptr, mr, size);
   }
 
+  size_t worker_count() const { return workers.size(); }
+  cq_stats stats(const size_t worker) const {
+    return workers[worker]->cq.stats();
+  }
+  void set_polling(const polling_policy &policy) {
+    for (auto &&worker : workers)
+      worker->cc.set_policy(policy);
+  }
+
+  /* receive on the SRQ of a worker */
+  template <typename T>
+  auto srq_recv_async(const size_t worker, const T &local, const ibv_mr *mr) {
+    using namespace hydra::rdma;
+    return rdma_recv_async(workers[worker]->srq, address_of(local), mr,
+                           size_of(local));
+  }
+
   template <typename T>
   auto recv_async(const qp_t qp_num, const T &local, const ibv_mr *mr,
                   size_t size = sizeof(T)) {
@@ -147,5 +252,8 @@ public:
 
   mr_t register_memory(const ibv_access &flags, const void *ptr,
                        const size_t size) const;
+
+  /* NUMA node the RDMA device is attached to, -1 if unknown */
+  int numa_node() const;
 };
 
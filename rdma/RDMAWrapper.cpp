@@ -1,4 +1,7 @@
 #include <iostream>
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
 #include <fstream>
 #include <string>
 #include <vector>
@@ -10,6 +13,8 @@
 #include <sys/resource.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "RDMAWrapper.hpp"
 
@@ -305,53 +310,139 @@ rdma_id_ptr createCmId(const std::string &host, const std::string &port,
   throw std::runtime_error(s.str());
 }
 
+completion_contexts::completion_contexts() {
+  for (auto &&c : chunks)
+    c.store(nullptr, std::memory_order_relaxed);
+}
+
+completion_contexts::~completion_contexts() {
+  for (size_t i = 0; i < n_chunks; i++)
+    delete chunks[i].load(std::memory_order_relaxed);
+}
+
+completion_contexts &completion_contexts::instance() {
+  static completion_contexts contexts;
+  return contexts;
+}
+
+void completion_contexts::grow() {
+  if (n_chunks == max_chunks)
+    throw std::runtime_error("Too many outstanding work requests");
+  const uint32_t first = static_cast<uint32_t>(n_chunks * chunk_size);
+  chunks[n_chunks++].store(new chunk, std::memory_order_release);
+  free.reserve(n_chunks * chunk_size);
+  /* hand out low indices first */
+  for (uint32_t i = chunk_size; i > 0; i--)
+    free.push_back(first + i - 1);
+}
+
+uint64_t completion_contexts::acquire() {
+  uint32_t index;
+  {
+    std::unique_lock<hydra::spinlock> l(lock);
+    if (free.empty())
+      grow();
+    index = free.back();
+    free.pop_back();
+  }
+  const uint64_t wr_id = index + 1;
+  new (&(*this)[wr_id]) promise_type();
+  return wr_id;
+}
+
+void completion_contexts::release(const uint64_t wr_id) noexcept {
+  (*this)[wr_id].~promise_type();
+  std::unique_lock<hydra::spinlock> l(lock);
+  /* cannot reallocate, capacity covers all indices */
+  free.push_back(static_cast<uint32_t>(wr_id - 1));
+}
+
 void rdma_completion(const ibv_wc &wc) noexcept {
-  hydra::promise<qp_t> *promise =
-      reinterpret_cast<hydra::promise<qp_t> *>(wc.wr_id);
-  if (promise && wc.status == IBV_WC_SUCCESS) {
-    promise->set_value(wc.qp_num);
+  auto &contexts = completion_contexts::instance();
+  auto &promise = contexts[wc.wr_id];
+  if (wc.status == IBV_WC_SUCCESS) {
+    promise.set_value(wc.qp_num);
   } else {
     log_info() << (enum ibv_wc_status)wc.status << " : " << wc.byte_len
-               << " wr_id: " << reinterpret_cast<void *>(promise) << " ("
-               << reinterpret_cast<void *>(wc.wr_id) << ")";
+               << " wr_id: " << wc.wr_id;
     std::ostringstream s;
     s << wc.opcode << " resulted in " << wc.status;
-    promise->set_exception(
+    promise.set_exception(
         std::make_exception_ptr(std::runtime_error(s.str())));
   }
-  delete promise;
+  contexts.release(wc.wr_id);
 }
 
-completion_channel::completion_channel(const rdma_id_ptr &id)
+polling_policy polling_policy::from_env() {
+  polling_policy policy;
+  const char *env = getenv("HYDRA_POLLING");
+  if (env == nullptr)
+    return policy;
+
+  const std::string value(env);
+  const std::string mode = value.substr(0, value.find(':'));
+  if (mode == "spin")
+    policy.mode = spin;
+  else if (mode == "event")
+    policy.mode = event;
+  else if (mode == "adaptive")
+    policy.mode = adaptive;
+  else
+    log_err() << "Unknown polling mode " << mode;
+
+  if (value.find(':') != std::string::npos)
+    policy.spin_time = std::chrono::microseconds(
+        std::stoll(value.substr(value.find(':') + 1)));
+
+  return policy;
+}
+
+std::ostream &operator<<(std::ostream &ostream, const cq_stats &stats) {
+  return ostream << stats.polls << " polls (" << stats.empty_polls
+                 << " empty), " << stats.completions << " completions, "
+                 << stats.wakeups << " wakeups";
+}
+
+completion_channel::completion_channel(const rdma_id_ptr &id,
+                                       const polling_policy &policy)
     : cc(check_nonnull(::ibv_create_comp_channel(id->verbs))),
-      run(std::make_unique<std::atomic_bool>(true)),
-      poller(std::bind(&completion_channel::loop, cc.get(), run.get())) {}
+      state_(std::make_unique<state>()) {
+  state_->run = true;
+  set_policy(policy);
+  poller = std::thread(&completion_channel::loop, cc.get(), state_.get());
+}
 completion_channel::~completion_channel() { stop(); }
 
+void completion_channel::pin(const unsigned cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  check_zero(
+      pthread_setaffinity_np(poller.native_handle(), sizeof(set), &set));
+}
+
 void completion_channel::stop() {
-  *run = false;
+  state_->run = false;
   if (poller.joinable())
     poller.join();
 }
 
-#define BUSY_WAIT 1
-
-void completion_channel::loop(ibv_comp_channel *cc, std::atomic_bool *run) {
-#if BUSY_WAIT
-  void *user_context = nullptr;
-  struct ibv_cq *cq = nullptr;
-
-  check_zero(ibv_get_cq_event(cc, &cq, &user_context));
-  auto *ptr = reinterpret_cast<completion_queue::cq *>(user_context);
-
-  ptr->ack();
+polling_policy completion_channel::policy() const {
+  return polling_policy(
+      static_cast<polling_policy::mode_t>(state_->mode.load()),
+      std::chrono::microseconds(state_->spin_us.load()));
+}
 
-  while (*run) {
-    if (ptr->poll())
-      return;
-  }
+void completion_channel::set_policy(const polling_policy &policy) {
+  state_->mode = policy.mode;
+  state_->spin_us = policy.spin_time.count();
+}
 
-#else
+/* The CQ is only known once its first event arrived. The epoll timeout bounds
+ * how long stop() waits for an idle poller.
+ */
+void completion_channel::loop(ibv_comp_channel *cc, state *state) {
+  using clock = std::chrono::steady_clock;
   epoll_event event;
   event.events = EPOLLIN;
   event.data.fd = cc->fd;
@@ -359,25 +450,56 @@ void completion_channel::loop(ibv_comp_channel *cc, std::atomic_bool *run) {
   hydra::util::epoll poll;
   poll.add(cc->fd, &event);
 
-  while (*run) {
-    if (poll.wait(&event, 1, 1)) {
-      if (event.data.fd == cc->fd) {
+  completion_queue::cq *ptr = nullptr;
+  auto wait = [&]() {
+    while (state->run) {
+      if (poll.wait(&event, 1, 1) && event.data.fd == cc->fd) {
         void *user_context = nullptr;
         struct ibv_cq *cq = nullptr;
 
         check_zero(ibv_get_cq_event(cc, &cq, &user_context));
-        auto *ptr = reinterpret_cast<completion_queue::cq *>(user_context);
-
-        if (ptr->handle())
-          return;
+        ptr = reinterpret_cast<completion_queue::cq *>(user_context);
+        ptr->ack();
+        return true;
       }
     }
+    return false;
+  };
+
+  if (!wait())
+    return;
+  auto idle_since = clock::now();
+
+  while (state->run) {
+    size_t completed = 0;
+    if (ptr->poll(&completed))
+      return;
+    if (completed) {
+      idle_since = clock::now();
+      continue;
+    }
+
+    const auto mode = state->mode.load(std::memory_order_relaxed);
+    if (mode == polling_policy::spin)
+      continue;
+    if (mode == polling_policy::adaptive &&
+        clock::now() - idle_since <
+            std::chrono::microseconds(
+                state->spin_us.load(std::memory_order_relaxed)))
+      continue;
+
+    /* Completions that arrived before the notification was armed do not
+     * raise an event, so poll once more before going to sleep.
+     */
+    ptr->notify();
+    if (ptr->poll(&completed))
+      return;
+    if (!completed && !wait())
+      return;
+    idle_since = clock::now();
   }
-#endif
 }
 
-#undef BUSY_WAIT
-
 completion_queue::completion_queue(const rdma_id_ptr &id,
                                    const completion_channel &cc,
                                    const int entries, const size_t completions,
@@ -399,7 +521,8 @@ completion_queue::cq::cq(rdma_cm_id *id, ibv_comp_channel *cc,
                          const int completion_vector)
     : wcs(completions), outstanding_acks(outstanding_acks), events(0),
       cq_(check_nonnull(
-          ::ibv_create_cq(id->verbs, entries, this, cc, completion_vector))) {
+          ::ibv_create_cq(id->verbs, entries, this, cc, completion_vector))),
+      polls(0), empty_polls(0), completions(0), wakeups(0) {
   notify();
 }
 
@@ -413,6 +536,7 @@ void completion_queue::cq::notify() const {
 }
 
 void completion_queue::cq::ack() const {
+  wakeups.fetch_add(1, std::memory_order_relaxed);
   events++;
   if (events > outstanding_acks)
     ibv_ack_cq_events(*this, events.exchange(0));
@@ -420,15 +544,19 @@ void completion_queue::cq::ack() const {
 
 completion_queue::cq::operator ibv_cq *() const { return cq_.get(); }
 
-bool completion_queue::cq::poll() const {
+bool completion_queue::cq::poll(size_t *completed) const {
   bool flushing = false;
   int ret;
+  size_t total = 0;
 
   while ((ret = ibv_poll_cq(*this, static_cast<unsigned int>(wcs.size()),
                             wcs.data()))) {
     if (ret < 0)
       throw_errno("ibv_poll_cq()");
 
+    total += static_cast<size_t>(ret);
+    polls.fetch_add(1, std::memory_order_relaxed);
+
     if (ret > 1024)
       log_debug() << __func__ << " " << ret;
 
@@ -462,9 +590,25 @@ bool completion_queue::cq::poll() const {
     });
   }
 
+  /* the call which found the queue empty */
+  polls.fetch_add(1, std::memory_order_relaxed);
+  empty_polls.fetch_add(1, std::memory_order_relaxed);
+  completions.fetch_add(total, std::memory_order_relaxed);
+  if (completed)
+    *completed = total;
+
   return flushing;
 }
 
+cq_stats completion_queue::cq::stats() const {
+  cq_stats stats;
+  stats.polls = polls.load(std::memory_order_relaxed);
+  stats.empty_polls = empty_polls.load(std::memory_order_relaxed);
+  stats.completions = completions.load(std::memory_order_relaxed);
+  stats.wakeups = wakeups.load(std::memory_order_relaxed);
+  return stats;
+}
+
 bool completion_queue::cq::handle() const {
   notify();
   ack();
@@ -520,3 +664,52 @@ static rdma_initializer rdma_init;
 #else
 static rdma_initializer rdma_init;
 #endif
+
+void wr_chain::append(const ibv_wr_opcode opcode, const void *local,
+                      const size_t size, const ibv_mr *mr, const int flags) {
+  ibv_sge sge;
+  sge.addr = reinterpret_cast<uintptr_t>(local);
+  sge.length = static_cast<uint32_t>(size);
+  sge.lkey = mr ? mr->lkey : 0;
+  sges.push_back(sge);
+
+  ibv_send_wr wr;
+  memset(&wr, 0, sizeof(wr));
+  wr.opcode = opcode;
+  wr.num_sge = 1;
+  wr.send_flags = flags;
+  wrs.push_back(wr);
+}
+
+void wr_chain::read(void *local, const size_t size, const ibv_mr *mr,
+                    const uint64_t remote, const uint32_t rkey) {
+  append(IBV_WR_RDMA_READ, local, size, mr, 0);
+  wrs.back().wr.rdma.remote_addr = remote;
+  wrs.back().wr.rdma.rkey = rkey;
+}
+
+void wr_chain::send(const void *local, const size_t size, const ibv_mr *mr,
+                    const int flags) {
+  append(IBV_WR_SEND, local, size, mr, flags);
+}
+
+hydra::future<qp_t> wr_chain::post(ibv_qp *qp) {
+  assert(!wrs.empty());
+  /* link only now, push_back might have moved the requests */
+  for (size_t i = 0; i < wrs.size(); i++) {
+    wrs[i].sg_list = &sges[i];
+    wrs[i].next = (i + 1 < wrs.size()) ? &wrs[i + 1] : nullptr;
+  }
+  wrs.back().send_flags |= IBV_SEND_SIGNALED;
+
+  return async_rdma_operation([this, qp](void *context) {
+    ibv_send_wr *bad_wr = nullptr;
+    wrs.back().wr_id = reinterpret_cast<uintptr_t>(context);
+    return ibv_post_send(qp, wrs.data(), &bad_wr);
+  });
+}
+
+void wr_chain::clear() {
+  wrs.clear();
+  sges.clear();
+}
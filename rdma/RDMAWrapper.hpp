@@ -7,6 +7,8 @@
 #include <atomic>
 #include <utility>
 #include <vector>
+#include <cstring>
+#include <chrono>
 
 #include <sys/mman.h>
 
@@ -89,22 +91,62 @@ mr_t register_memory(ibv_pd *pd, const ibv_access &flags, const T &o) {
 
 class completion_queue;
 
+/* How the poller of a completion_channel waits for completions:
+ * spin     polls the CQ continuously; lowest latency, burns a core.
+ * event    sleeps on the completion channel whenever the CQ is empty.
+ * adaptive spins for spin_time after the last completion, then arms the
+ *          notification and sleeps.
+ * HYDRA_POLLING=spin|event|adaptive[:microseconds] selects the default.
+ */
+struct polling_policy {
+  enum mode_t { spin, event, adaptive };
+  mode_t mode = adaptive;
+  std::chrono::microseconds spin_time = std::chrono::microseconds(50);
+
+  polling_policy() = default;
+  polling_policy(const mode_t mode,
+                 const std::chrono::microseconds spin_time =
+                     std::chrono::microseconds(50))
+      : mode(mode), spin_time(spin_time) {}
+  static polling_policy from_env();
+};
+
+/* Counters of a completion queue; updated by the poller only. */
+struct cq_stats {
+  uint64_t polls = 0;       /* calls to ibv_poll_cq */
+  uint64_t empty_polls = 0; /* of which returned nothing */
+  uint64_t completions = 0;
+  uint64_t wakeups = 0;     /* completion events consumed */
+};
+
+std::ostream &operator<<(std::ostream &ostream, const cq_stats &stats);
+
 class completion_channel {
   struct cc_deleter {
     void operator()(ibv_comp_channel *cc) {
       check_zero(::ibv_destroy_comp_channel(cc));
     }
   };
+  struct state {
+    std::atomic_bool run;
+    std::atomic<int> mode;
+    std::atomic<int64_t> spin_us;
+  };
   std::unique_ptr<ibv_comp_channel, cc_deleter> cc;
-  std::unique_ptr<std::atomic_bool> run;
+  std::unique_ptr<state> state_;
   std::thread poller;
 
-  static void loop(ibv_comp_channel *, std::atomic_bool *);
+  static void loop(ibv_comp_channel *, state *);
 
 public:
-  completion_channel(const rdma_id_ptr &id);
+  completion_channel(const rdma_id_ptr &id,
+                     const polling_policy &policy = polling_policy::from_env());
   ~completion_channel();
   void stop();
+  polling_policy policy() const;
+  void set_policy(const polling_policy &policy);
+  /* restrict the poller thread to cpu */
+  void pin(const unsigned cpu);
   friend class completion_queue;
 };
 
@@ -119,6 +161,11 @@ class completion_queue {
     mutable std::atomic_uint events;
     std::unique_ptr<ibv_cq, cq_deleter> cq_;
 
+    mutable std::atomic<uint64_t> polls;
+    mutable std::atomic<uint64_t> empty_polls;
+    mutable std::atomic<uint64_t> completions;
+    mutable std::atomic<uint64_t> wakeups;
+
     void notify() const;
     operator ibv_cq *() const;
 
@@ -128,11 +175,14 @@ class completion_queue {
        const int completion_vector = 0);
     ~cq();
 
-    bool poll() const;
+    /* Drain the CQ. Returns true if the queue pair is being flushed. */
+    bool poll(size_t *completed = nullptr) const;
     void ack() const;
     bool handle() const;
+    cq_stats stats() const;
 
     friend class completion_queue;
+    friend class completion_channel;
   };
   std::unique_ptr<cq> cq_;
 
@@ -146,6 +196,7 @@ public:
                    const unsigned int outstanding_acks = 0,
                    const int completion_vector = 0);
   operator ibv_cq *() const { return *cq_; }
+  cq_stats stats() const { return cq_->stats(); }
   friend class completion_channel;
 };
 
@@ -219,14 +270,62 @@ auto async_rdma_operation2(RDMAFunctor &&functor, T value)
   return promise->get_future();
 }
 
+/* Promises of outstanding work requests. The wr_id of a request is the index
+ * of its promise plus one, so that 0 still marks requests whose completion is
+ * ignored. Promises live in chunks, which are never freed, and their indices
+ * are recycled through a free list. Together with the pooled shared states of
+ * hydra::promise, an operation does not allocate in steady state.
+ */
+class completion_contexts {
+  using promise_type = hydra::promise<qp_t>;
+  using storage_type =
+      std::aligned_storage<sizeof(promise_type), alignof(promise_type)>::type;
+
+  static constexpr size_t chunk_size = 4096;
+  static constexpr size_t max_chunks = 1024;
+
+  struct chunk {
+    storage_type contexts[chunk_size];
+  };
+
+  std::atomic<chunk *> chunks[max_chunks];
+  size_t n_chunks = 0;
+  std::vector<uint32_t> free;
+  hydra::spinlock lock;
+
+  completion_contexts();
+  void grow();
+
+public:
+  ~completion_contexts();
+  static completion_contexts &instance();
+
+  /* Returns the wr_id of a new promise. */
+  uint64_t acquire();
+  /* Destroys the promise and makes wr_id available again. */
+  void release(const uint64_t wr_id) noexcept;
+
+  promise_type &operator[](const uint64_t wr_id) const noexcept {
+    const uint64_t index = wr_id - 1;
+    chunk *c = chunks[index / chunk_size].load(std::memory_order_acquire);
+    return *reinterpret_cast<promise_type *>(&c->contexts[index % chunk_size]);
+  }
+};
+
 void rdma_completion(const ibv_wc&) noexcept;
 
 template <typename RDMA_Callable>
 hydra::future<qp_t> async_rdma_operation(RDMA_Callable &&functor) {
-  auto promise = new hydra::promise<qp_t>();
-  auto future = promise->get_future();
+  auto &contexts = completion_contexts::instance();
+  const uint64_t wr_id = contexts.acquire();
+  auto future = contexts[wr_id].get_future();
 
-  check_zero(functor(reinterpret_cast<void *>(promise)));
+  if (functor(reinterpret_cast<void *>(wr_id))) {
+    const int err = errno;
+    contexts.release(wr_id);
+    errno = err;
+    throw_errno(__func__);
+  }
 
   return future;
 }
@@ -250,6 +349,28 @@ auto rdma_recv_async(rdma_cm_id *id, const T *local, const ibv_mr *mr,
   return async_rdma_operation(func);
 }
 
+/* Post to a SRQ which is not attached to a rdma_cm_id. */
+template <typename T>
+auto rdma_recv_async(ibv_srq *srq, const T *local, const ibv_mr *mr,
+                     size_t size = sizeof(T)) {
+  auto func = [=](void *context) {
+    ibv_sge sge;
+    sge.addr = reinterpret_cast<uintptr_t>(local);
+    sge.length = static_cast<uint32_t>(size);
+    sge.lkey = mr->lkey;
+
+    ibv_recv_wr wr;
+    memset(&wr, 0, sizeof(wr));
+    wr.wr_id = reinterpret_cast<uintptr_t>(context);
+    wr.sg_list = &sge;
+    wr.num_sge = 1;
+
+    ibv_recv_wr *bad_wr = nullptr;
+    return ibv_post_srq_recv(srq, &wr, &bad_wr);
+  };
+  return async_rdma_operation(func);
+}
+
 template <typename T>
 auto rdma_recv_async(const rdma_id_ptr &id, const rdma_ptr<T> &ptr,
                      const size_t size = sizeof(T)) {
@@ -276,3 +397,27 @@ decltype(auto) rdma_read_async__(rdma_cm_id *id, T *local, size_t size, const ib
   return async_rdma_operation(functor);
 }
 
+
+/* Work requests collected to be posted with a single doorbell. Only the last
+ * one is signaled. Send queue completions arrive in order, so its completion
+ * implies that all requests before it are complete as well.
+ */
+class wr_chain {
+  std::vector<ibv_send_wr> wrs;
+  std::vector<ibv_sge> sges;
+
+  void append(const ibv_wr_opcode opcode, const void *local, const size_t size,
+              const ibv_mr *mr, const int flags);
+
+public:
+  void read(void *local, const size_t size, const ibv_mr *mr,
+            const uint64_t remote, const uint32_t rkey);
+  void send(const void *local, const size_t size, const ibv_mr *mr,
+            const int flags = 0);
+
+  hydra::future<qp_t> post(ibv_qp *qp);
+
+  size_t size() const { return wrs.size(); }
+  bool empty() const { return wrs.empty(); }
+  void clear();
+};
@@ -17,7 +17,7 @@ void shared_state<void>::set_(expected_type value) {
     throw std::future_error(
         std::make_error_code(std::future_errc::promise_already_satisfied));
   } else if (continuation_) {
-    continuation_->dispatch(expected_type(std::move(value)));
+    continuation_.dispatch(expected_type(std::move(value)));
   } else {
     data = std::move(value);
   }
@@ -41,8 +41,7 @@ void shared_state<void>::wait() {
 }
 }
 
-promise<void>::promise()
-    : state(std::make_shared<detail::shared_state<void> >()) {}
+promise<void>::promise() : state(detail::make_shared_state<void>()) {}
 promise<void>::promise(promise &&) = default;
 
 future<void> promise<void>::get_future() {
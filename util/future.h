@@ -6,6 +6,9 @@
 #include <exception>
 #include <thread>
 #include <mutex>
+#include <new>
+#include <type_traits>
+#include <cstddef>
 
 #include <iostream>
 
@@ -20,11 +23,83 @@ template <typename T> class promise;
 
 namespace detail {
 template <typename T> class shared_state;
+template <typename T> class continuation;
+
+/* Fixed-size blocks, recycled through a free list. Shared states are allocated
+ * from here, so that creating a promise does not call malloc in steady state.
+ * Blocks are never returned to the system.
+ */
+template <size_t Size> class block_pool {
+  union block {
+    block *next;
+    typename std::aligned_storage<Size, alignof(std::max_align_t)>::type data;
+  };
+
+  block *head = nullptr;
+  hydra::spinlock lock;
+
+public:
+  static block_pool &instance() {
+    static block_pool pool;
+    return pool;
+  }
+
+  void *allocate() {
+    {
+      std::unique_lock<hydra::spinlock> l(lock);
+      if (head) {
+        block *b = head;
+        head = b->next;
+        return b;
+      }
+    }
+    return ::operator new(sizeof(block));
+  }
+
+  void deallocate(void *p) noexcept {
+    block *b = static_cast<block *>(p);
+    std::unique_lock<hydra::spinlock> l(lock);
+    b->next = head;
+    head = b;
+  }
+};
+
+template <typename T> struct pool_allocator {
+  using value_type = T;
+
+  pool_allocator() = default;
+  template <typename U> pool_allocator(const pool_allocator<U> &) {}
+
+  T *allocate(const size_t n) {
+    if (n != 1)
+      return std::allocator<T>().allocate(n);
+    return static_cast<T *>(block_pool<sizeof(T)>::instance().allocate());
+  }
+
+  void deallocate(T *p, const size_t n) noexcept {
+    if (n != 1)
+      std::allocator<T>().deallocate(p, n);
+    else
+      block_pool<sizeof(T)>::instance().deallocate(p);
+  }
+
+  template <typename U> bool operator==(const pool_allocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const pool_allocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename T> std::shared_ptr<shared_state<T> > make_shared_state() {
+  return std::allocate_shared<shared_state<T> >(
+      pool_allocator<shared_state<T> >());
+}
 }
 
 template <typename T> class promise {
 public:
-  promise() : state(std::make_shared<detail::shared_state<T> >()) {}
+  promise() : state(detail::make_shared_state<T>()) {}
   promise(promise &&) = default;
   promise(const promise &) = delete;
 
@@ -60,6 +135,7 @@ private:
       throw std::future_error(std::make_error_code(std::future_errc::no_state));
     }
   }
+  template <typename> friend class detail::continuation;
   bool have_future = false;
   std::shared_ptr<detail::shared_state<T> > state;
 };
@@ -76,6 +152,7 @@ public:
 
 private:
   void check_state();
+  template <typename> friend class detail::continuation;
   bool have_future = false;
   std::shared_ptr<detail::shared_state<void> > state;
 };
@@ -235,12 +312,38 @@ template <typename Callable> void schedule_task(Callable &&c) {
 template <typename Callable> void schedule_task(Callable &&c) { c(); }
 #endif
 
+/* Type-erased continuation. Small callables are stored in place, larger ones
+ * on the heap. Only the state of the promise is kept, which is all that
+ * completing it needs.
+ */
 template <typename T> class continuation {
 public:
+  continuation() = default;
+  continuation(const continuation &) = delete;
+  continuation &operator=(const continuation &) = delete;
+  ~continuation() { reset(); }
+
   template <typename Callable, typename R>
-  continuation(Callable &&c, promise<R> p)
-      : impl(std::make_unique<model<Callable, R> >(std::forward<Callable>(c),
-                                                   std::move(p))) {}
+  void emplace(Callable &&c, promise<R> p) {
+    using model_type = model<Callable, R>;
+    reset();
+    if (sizeof(model_type) <= sizeof(storage) &&
+        alignof(model_type) <= alignof(storage_type)) {
+      impl = new (&storage) model_type(std::forward<Callable>(c), std::move(p));
+    } else {
+      impl = new model_type(std::forward<Callable>(c), std::move(p));
+    }
+  }
+
+  void reset() {
+    if (impl == reinterpret_cast<concept *>(&storage))
+      impl->~concept();
+    else
+      delete impl;
+    impl = nullptr;
+  }
+
+  explicit operator bool() const { return impl != nullptr; }
 
   void dispatch(boost::expected<T, std::exception_ptr> value) {
     impl->dispatch(std::move(value));
@@ -256,21 +359,21 @@ private:
   template <typename Callable, typename R> class model final : public concept {
   public:
     model(Callable &&c, promise<R> p)
-        : c_(std::forward<Callable>(c)), promise(std::move(p)) {}
+        : c_(std::forward<Callable>(c)), state(std::move(p.state)) {}
     virtual ~model() = default;
 
     virtual void
     dispatch(boost::expected<T, std::exception_ptr> value) override {
       schedule_task([
         c = std::move(c_),
-        promise = std::move(promise),
+        state = std::move(state),
         value = std::move(value)
       ]() mutable {
           try{
-            promise.set_value(c(std::move(value)));
+            state->set(c(std::move(value)));
           } catch (...) {
             try {
-              promise.set_exception(std::current_exception());
+              state->set_exception(std::current_exception());
             }
             catch (...) {
             }
@@ -280,29 +383,29 @@ private:
 
   private:
     Callable c_;
-    class promise<R> promise;
+    std::shared_ptr<shared_state<R> > state;
   };
 
   template <typename Callable>
   class model<Callable, void> final : public concept {
   public:
     model(Callable &&c, promise<void> p)
-        : c_(std::forward<Callable>(c)), promise(std::move(p)) {}
+        : c_(std::forward<Callable>(c)), state(std::move(p.state)) {}
     virtual ~model() = default;
 
     virtual void
     dispatch(boost::expected<T, std::exception_ptr> value) override {
       schedule_task([
         c = std::move(c_),
-        promise = std::move(promise),
+        state = std::move(state),
         value = std::move(value)
       ]() mutable { 
           try{
             c(std::move(value));
-            promise.set_value();
+            state->set();
           } catch (...) {
             try {
-              promise.set_exception(std::current_exception());
+              state->set_exception(std::current_exception());
             }
             catch (...) {
             }
@@ -312,10 +415,17 @@ private:
 
   private:
     Callable c_;
-    class promise<void> promise;
+    std::shared_ptr<shared_state<void> > state;
   };
 
-  std::unique_ptr<concept> impl;
+  /* Every shared state carries this, continuation or not. 48 bytes hold the
+   * vtable pointer, the promise's state and a callable of up to 24 bytes,
+   * such as [this, shared_ptr] of the lookups in passive or [this, &request]
+   * of the receive loops in node and passive.
+   */
+  using storage_type = typename std::aligned_storage<48>::type;
+  storage_type storage;
+  concept *impl = nullptr;
 };
 
 template <typename T>
@@ -357,10 +467,9 @@ public:
     promise<R> promise;
     auto future = promise.get_future();
 
-    continuation_ = std::make_unique<continuation<T> >(std::forward<Functor>(f),
-                                                       std::move(promise));
+    continuation_.emplace(std::forward<Functor>(f), std::move(promise));
     if (satisfied) {
-      continuation_->dispatch(std::move(data));
+      continuation_.dispatch(std::move(data));
     }
 
     return future;
@@ -373,7 +482,7 @@ private:
       throw std::future_error(
           std::make_error_code(std::future_errc::promise_already_satisfied));
     } else if (continuation_) {
-      continuation_->dispatch(expected_type(std::move(value)));
+      continuation_.dispatch(expected_type(std::move(value)));
     } else {
       data = std::move(value);
     }
@@ -383,7 +492,7 @@ private:
   expected_type data;
   std::atomic_bool satisfied;
   typename detail::lock_type state_lock;
-  std::unique_ptr<continuation<T> > continuation_;
+  continuation<T> continuation_;
 };
 
 template <> class shared_state<void> {
@@ -408,10 +517,9 @@ public:
     promise<R> promise;
     auto future = promise.get_future();
 
-    continuation_ = std::make_unique<continuation<void> >(
-        std::forward<Functor>(f), std::move(promise));
+    continuation_.emplace(std::forward<Functor>(f), std::move(promise));
     if (satisfied) {
-      continuation_->dispatch(std::move(data));
+      continuation_.dispatch(std::move(data));
     }
 
     return future;
@@ -422,7 +530,7 @@ private:
   expected_type data;
   std::atomic_bool satisfied;
   typename detail::lock_type state_lock;
-  std::unique_ptr<continuation<void> > continuation_;
+  continuation<void> continuation_;
 };
 }
 
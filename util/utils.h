@@ -2,6 +2,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <new>
 #include <type_traits>
 #include <ostream>
 
@@ -22,6 +24,26 @@ inline uint64_t log2(const uint64_t val) {
   asm("bsrq %1,%0" : "=r"(log2) : "r"(val));
   return log2;
 }
+
+/* operator new does not honour over-aligned types before C++17 */
+template <typename T> struct aligned_allocator {
+  using value_type = T;
+  aligned_allocator() = default;
+  template <typename U> aligned_allocator(const aligned_allocator<U> &) {}
+  T *allocate(size_t n) {
+    void *p;
+    if (posix_memalign(&p, alignof(T), n * sizeof(T)))
+      throw std::bad_alloc();
+    return static_cast<T *>(p);
+  }
+  void deallocate(T *p, size_t) { free(p); }
+  template <typename U> bool operator==(const aligned_allocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const aligned_allocator<U> &) const {
+    return false;
+  }
+};
 }
 }
 